@@ -0,0 +1,168 @@
+// Топология процессоров и привязка потоков к ним. Узлы NUMA читаются из
+// sysfs, привязка — через pthread_setaffinity_np; libnuma не нужна. Память
+// становится локальной узлу по первому касанию из привязанного потока.
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+// Как раскладывать потоки по процессорам
+enum class Affinity {
+    None, // решает планировщик ОС
+    Core, // каждый поток на свой процессор, узлы чередуются по кругу
+    Node  // поток привязан ко всем процессорам своего узла
+};
+
+inline const char* affinity_name(Affinity a) {
+    switch (a) {
+    case Affinity::Core: return "core";
+    case Affinity::Node: return "node";
+    default: return "none";
+    }
+}
+
+// "none" | "core" | "node"; всё остальное — None
+inline Affinity parse_affinity(const std::string& s) {
+    if (s == "core") {
+        return Affinity::Core;
+    }
+    if (s == "node") {
+        return Affinity::Node;
+    }
+    return Affinity::None;
+}
+
+// Список номеров в формате sysfs: "0-3,8,10-11"
+inline std::vector<unsigned> parse_cpu_list(const std::string& s) {
+    std::vector<unsigned> cpus;
+    std::stringstream ss(s);
+    std::string part;
+    while (std::getline(ss, part, ',')) {
+        if (part.empty() || part == "\n") {
+            continue;
+        }
+        size_t dash = part.find('-');
+        unsigned lo = std::stoul(part.substr(0, dash));
+        unsigned hi = dash == std::string::npos ? lo : std::stoul(part.substr(dash + 1));
+        for (unsigned c = lo; c <= hi; c++) {
+            cpus.push_back(c);
+        }
+    }
+    return cpus;
+}
+
+// Узлы нумеруются подряд с нуля, в порядке номеров ОС
+struct CpuTopology {
+    std::vector<std::vector<unsigned>> node_cpus; // процессоры каждого узла
+    std::vector<int> cpu_node;                    // узел по номеру процессора
+
+    // Узлы без процессоров (только память) пропускаются. Без sysfs — один
+    // узел со всеми процессорами.
+    static CpuTopology detect() {
+        CpuTopology topo;
+        // Номера узлов могут идти с пропусками: берём список из online
+        std::string line;
+        std::ifstream online("/sys/devices/system/node/online");
+        std::getline(online, line);
+        for (unsigned node : parse_cpu_list(line)) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            line.clear();
+            std::getline(in, line);
+            std::vector<unsigned> cpus = parse_cpu_list(line);
+            if (!cpus.empty()) {
+                topo.node_cpus.push_back(std::move(cpus));
+            }
+        }
+        if (topo.node_cpus.empty()) {
+            unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+            topo.node_cpus.emplace_back();
+            for (unsigned c = 0; c < hw; c++) {
+                topo.node_cpus[0].push_back(c);
+            }
+        }
+        for (size_t node = 0; node < topo.node_cpus.size(); node++) {
+            for (unsigned c : topo.node_cpus[node]) {
+                if (c >= topo.cpu_node.size()) {
+                    topo.cpu_node.resize(c + 1, -1);
+                }
+                topo.cpu_node[c] = static_cast<int>(node);
+            }
+        }
+        return topo;
+    }
+
+    unsigned node_count() const { return static_cast<unsigned>(node_cpus.size()); }
+
+    // Узел процессора, на котором поток выполняется сейчас
+    int current_node() const {
+        int cpu = sched_getcpu();
+        if (cpu < 0 || static_cast<size_t>(cpu) >= cpu_node.size() || cpu_node[cpu] < 0) {
+            return 0;
+        }
+        return cpu_node[cpu];
+    }
+};
+
+inline const CpuTopology& cpu_topology() {
+    static const CpuTopology topo = CpuTopology::detect();
+    return topo;
+}
+
+// Место потока: узел и процессоры, к которым его привязать (пусто — не
+// привязывать). Узел назначается и при Affinity::None: по нему потоки делят
+// очереди узлов, даже если ОС вольна их переносить.
+struct ThreadPlacement {
+    unsigned node = 0;
+    std::vector<unsigned> cpus;
+};
+
+// Поток i попадает на узел i % nodes: пул любого размера задействует все
+// узлы и их каналы памяти. Внутри узла Core берёт процессоры по порядку.
+inline std::vector<ThreadPlacement> plan_placement(const CpuTopology& topo, unsigned threads,
+                                                   Affinity affinity) {
+    std::vector<ThreadPlacement> plan(threads);
+    unsigned nodes = topo.node_count();
+    for (unsigned i = 0; i < threads; i++) {
+        unsigned node = i % nodes;
+        const std::vector<unsigned>& cpus = topo.node_cpus[node];
+        plan[i].node = node;
+        if (affinity == Affinity::Core) {
+            plan[i].cpus.push_back(cpus[(i / nodes) % cpus.size()]);
+        } else if (affinity == Affinity::Node) {
+            plan[i].cpus = cpus;
+        }
+    }
+    return plan;
+}
+
+// Узел, назначенный потоку привязкой (-1 — поток не размещали)
+inline thread_local int current_node = -1;
+
+// Привязывает текущий поток; false — ОС отказала (процессор недоступен
+// в cgroup и т.п.), поток остаётся где был
+inline bool apply_placement(const ThreadPlacement& place) {
+    current_node = static_cast<int>(place.node);
+    if (place.cpus.empty()) {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned c : place.cpus) {
+        CPU_SET(c, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// Узел текущего потока: назначенный, а у неразмещённых — текущий процессора
+inline unsigned thread_node() {
+    if (current_node >= 0) {
+        return static_cast<unsigned>(current_node);
+    }
+    return static_cast<unsigned>(cpu_topology().current_node());
+}
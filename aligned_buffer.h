@@ -0,0 +1,55 @@
+// Буферы под матрицы и векторы. Начало выровнено по 64 байта: строка кеша
+// и загрузка AVX-512 не разрываются. Большие буферы берутся через mmap,
+// выровненными по 2 МБ, с MADV_HUGEPAGE — ядро отдаёт прозрачные большие
+// страницы, и проход по матрице не упирается в промахи TLB.
+//
+// Память не обнуляется и не трогается: страница появляется при первой
+// записи на узле NUMA записавшего потока. Заполнять буфер надо из тех же
+// потоков, что потом его читают.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <sys/mman.h>
+
+constexpr size_t CACHE_LINE = 64;
+constexpr size_t HUGE_PAGE = size_t(2) << 20;
+
+template <typename T>
+std::shared_ptr<T[]> make_buffer(size_t count) {
+    static_assert(std::is_trivially_default_constructible_v<T> && std::is_trivially_destructible_v<T>,
+                  "make_buffer hands out raw memory");
+    size_t bytes = std::max<size_t>(1, count * sizeof(T));
+    if (bytes < HUGE_PAGE) {
+        void* p = std::aligned_alloc(CACHE_LINE, (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return std::shared_ptr<T[]>(static_cast<T*>(p), [](T* q) { std::free(q); });
+    }
+
+    // Берём на страницу больше и обрезаем края, чтобы начало легло на 2 МБ
+    size_t len = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    size_t span = len + HUGE_PAGE;
+    void* raw = ::mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    uintptr_t start = (reinterpret_cast<uintptr_t>(raw) + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    size_t head = start - reinterpret_cast<uintptr_t>(raw);
+    if (head > 0) {
+        ::munmap(raw, head);
+    }
+    if (span - head > len) {
+        ::munmap(reinterpret_cast<void*>(start + len), span - head - len);
+    }
+#ifdef MADV_HUGEPAGE
+    ::madvise(reinterpret_cast<void*>(start), len, MADV_HUGEPAGE);
+#endif
+    return std::shared_ptr<T[]>(reinterpret_cast<T*>(start), [len](T* q) { ::munmap(q, len); });
+}
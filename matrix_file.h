@@ -0,0 +1,368 @@
+// Матрица на диске. Формат: заголовок на всю первую страницу (4096 байт),
+// затем строки подряд элементами Storage. Данные начинаются с границы
+// страницы, поэтому отображаются mmap без копирования и сдвига.
+//
+// Два способа чтения: MappedMatrix отображает файл целиком (страницы
+// подгружаются при первом касании, файл не копируется), PanelStream читает
+// его панелями строк в отдельном потоке — для матриц больше ОЗУ, чтение
+// идёт параллельно со счётом предыдущей панели.
+#pragma once
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mv_kernel.h"
+
+constexpr size_t MATRIX_FILE_HEADER = 4096;
+constexpr char MATRIX_FILE_MAGIC[8] = {'M', 'V', 'M', 'A', 'T', 'R', 'X', '1'};
+
+struct MatrixFileHeader {
+    char magic[8];
+    uint64_t rows;
+    uint64_t cols;
+    uint32_t storage; // Storage
+    uint32_t reserved;
+};
+
+inline std::system_error io_error(const std::string& what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+inline std::system_error format_error(const std::string& what) {
+    return std::system_error(std::make_error_code(std::errc::invalid_argument), what);
+}
+
+// Заголовок из первых байт файла; бросает, если это не файл матрицы или
+// его длина не сходится с размерами
+inline MatrixFileHeader parse_matrix_header(const void* p, size_t file_size, const std::string& path) {
+    MatrixFileHeader h;
+    if (file_size < MATRIX_FILE_HEADER) {
+        throw format_error(path + ": too short for a matrix file");
+    }
+    std::memcpy(&h, p, sizeof(h));
+    if (std::memcmp(h.magic, MATRIX_FILE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.storage > static_cast<uint32_t>(Storage::Fp16)) {
+        throw format_error(path + ": not a matrix file");
+    }
+    uint64_t data = h.rows * h.cols * storage_size(static_cast<Storage>(h.storage));
+    if (file_size != MATRIX_FILE_HEADER + data) {
+        throw format_error(path + ": size does not match header");
+    }
+    return h;
+}
+
+inline void write_all(int fd, const void* p, size_t len, const std::string& path) {
+    const char* c = static_cast<const char*>(p);
+    while (len > 0) {
+        ssize_t w = ::write(fd, c, len);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw io_error("write " + path);
+        }
+        c += w;
+        len -= static_cast<size_t>(w);
+    }
+}
+
+// Читает ровно len байт со смещения off
+inline void pread_all(int fd, void* p, size_t len, off_t off, const std::string& path) {
+    char* c = static_cast<char*>(p);
+    while (len > 0) {
+        ssize_t r = ::pread(fd, c, len, off);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw io_error("read " + path);
+        }
+        if (r == 0) {
+            throw format_error(path + ": unexpected end of file");
+        }
+        c += r;
+        off += r;
+        len -= static_cast<size_t>(r);
+    }
+}
+
+// Пишет матрицу m x n элементами T панелями по panel_rows строк:
+// fill(row0, rows, dst) заполняет панель строк [row0, row0 + rows). Вся
+// матрица в памяти не нужна, так что так готовятся и файлы больше ОЗУ.
+// Пишется во временный файл и переименовывается: недописанный файл не
+// подхватится следующим запуском.
+template <typename T, typename Fill>
+void write_matrix_file(const std::string& path, size_t m, size_t n, Fill&& fill,
+                       size_t panel_rows = 256) {
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw io_error("open " + tmp);
+    }
+    try {
+        std::vector<char> header(MATRIX_FILE_HEADER, 0);
+        MatrixFileHeader h{};
+        std::memcpy(h.magic, MATRIX_FILE_MAGIC, sizeof(h.magic));
+        h.rows = m;
+        h.cols = n;
+        h.storage = static_cast<uint32_t>(storage_of<T>());
+        std::memcpy(header.data(), &h, sizeof(h));
+        write_all(fd, header.data(), header.size(), tmp);
+
+        std::vector<T> panel(panel_rows * n);
+        for (size_t row0 = 0; row0 < m; row0 += panel_rows) {
+            size_t rows = std::min(panel_rows, m - row0);
+            fill(row0, rows, panel.data());
+            write_all(fd, panel.data(), rows * n * sizeof(T), tmp);
+        }
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw;
+    }
+    if (::close(fd) != 0) {
+        throw io_error("close " + tmp);
+    }
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+        throw io_error("rename " + tmp);
+    }
+}
+
+// Только заголовок: чтобы решить, годится ли уже лежащий файл
+inline bool read_matrix_header(const std::string& path, MatrixFileHeader& h) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    char buf[sizeof(MatrixFileHeader)];
+    bool ok = ::fstat(fd, &st) == 0 && ::pread(fd, buf, sizeof(buf), 0) == sizeof(buf);
+    ::close(fd);
+    if (!ok) {
+        return false;
+    }
+    try {
+        h = parse_matrix_header(buf, static_cast<size_t>(st.st_size), path);
+    } catch (const std::system_error&) {
+        return false;
+    }
+    return true;
+}
+
+// Файл, отображённый только для чтения. Подсказки ядру: MADV_WILLNEED —
+// начать чтение заранее, MADV_HUGEPAGE — большие страницы там, где их даёт
+// файловая система (tmpfs с huge=, ядро с READ_ONLY_THP_FOR_FS); отказ
+// подсказки не ошибка. populate — подгрузить все страницы сразу
+// (MAP_POPULATE), чтобы первый замер не платил за страничные промахи.
+class MappedMatrix {
+public:
+    explicit MappedMatrix(const std::string& path, bool populate = false) : path(path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw io_error("open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            throw io_error("stat " + path);
+        }
+        length = static_cast<size_t>(st.st_size);
+        base = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+        if (base == MAP_FAILED) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            throw io_error("mmap " + path);
+        }
+        try {
+            header = parse_matrix_header(base, length, path);
+        } catch (...) {
+            ::munmap(base, length);
+            ::close(fd);
+            throw;
+        }
+        ::madvise(base, length, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+        ::madvise(base, length, MADV_HUGEPAGE);
+#endif
+    }
+
+    MappedMatrix(const MappedMatrix&) = delete;
+    MappedMatrix& operator=(const MappedMatrix&) = delete;
+
+    ~MappedMatrix() {
+        ::munmap(base, length);
+        ::close(fd);
+    }
+
+    size_t rows() const { return header.rows; }
+    size_t cols() const { return header.cols; }
+    Storage storage() const { return static_cast<Storage>(header.storage); }
+
+    // T должен совпадать с storage(): иначе размер элемента другой, и
+    // строки прочитались бы за концом отображения
+    template <typename T>
+    const T* data() const {
+        if (storage() != storage_of<T>()) {
+            throw format_error(path + ": stored as " + storage_name(storage()) + ", not " +
+                               storage_name(storage_of<T>()));
+        }
+        return reinterpret_cast<const T*>(static_cast<const char*>(base) + MATRIX_FILE_HEADER);
+    }
+
+private:
+    std::string path;
+    int fd = -1;
+    void* base = nullptr;
+    size_t length = 0;
+    MatrixFileHeader header{};
+};
+
+// Чтение панелями по panel_rows строк в depth буферов. Поток чтения
+// заполняет свободный буфер, пока потребитель считает по заполненному:
+// next() — следующая панель по порядку, release() — вернуть самую старую
+// из взятых. Прочитанное сбрасывается из страничного кеша
+// (POSIX_FADV_DONTNEED): проход по матрице больше ОЗУ не вытесняет всё
+// остальное, но и повторный проход снова читает диск.
+template <typename T>
+class PanelStream {
+public:
+    struct Panel {
+        size_t row0;
+        size_t rows;
+        const T* data;
+    };
+
+    PanelStream(const std::string& path, size_t panel_rows, size_t depth = 3)
+        : path(path), panel_rows(std::max<size_t>(1, panel_rows)) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw io_error("open " + path);
+        }
+        try {
+            struct stat st;
+            char buf[sizeof(MatrixFileHeader)];
+            if (::fstat(fd, &st) != 0) {
+                throw io_error("stat " + path);
+            }
+            pread_all(fd, buf, sizeof(buf), 0, path);
+            header = parse_matrix_header(buf, static_cast<size_t>(st.st_size), path);
+            if (static_cast<Storage>(header.storage) != storage_of<T>()) {
+                throw format_error(path + ": stored as " +
+                                   storage_name(static_cast<Storage>(header.storage)) + ", not " +
+                                   storage_name(storage_of<T>()));
+            }
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        // Буферы не больше самой матрицы и без обнуления: всё равно
+        // перезаписываются чтением
+        this->panel_rows = std::min<size_t>(this->panel_rows, std::max<uint64_t>(1, header.rows));
+        panels = (header.rows + this->panel_rows - 1) / this->panel_rows;
+        bufs.resize(std::clamp<size_t>(panels, 1, std::max<size_t>(1, depth)));
+        for (auto& b : bufs) {
+            b.reset(new T[this->panel_rows * header.cols]);
+        }
+        reader = std::jthread([this](std::stop_token st) { read_loop(st); });
+    }
+
+    PanelStream(const PanelStream&) = delete;
+    PanelStream& operator=(const PanelStream&) = delete;
+
+    ~PanelStream() {
+        reader.request_stop();
+        reader.join();
+        ::close(fd);
+    }
+
+    size_t rows() const { return header.rows; }
+    size_t cols() const { return header.cols; }
+
+    // Ждёт следующую панель; false — панели кончились. Ошибку чтения
+    // бросает здесь, в потоке потребителя.
+    bool next(Panel& p) {
+        std::unique_lock lock(mtx);
+        cv.wait(lock, [&] { return produced > taken || taken == panels || error; });
+        if (taken == panels) {
+            return false;
+        }
+        if (produced == taken) {
+            std::rethrow_exception(error);
+        }
+        size_t row0 = taken * panel_rows;
+        p = Panel{row0, std::min(panel_rows, header.rows - row0), bufs[taken % bufs.size()].get()};
+        taken++;
+        return true;
+    }
+
+    void release() {
+        {
+            std::lock_guard lock(mtx);
+            consumed++;
+        }
+        cv.notify_all();
+    }
+
+private:
+    void read_loop(std::stop_token st) {
+        size_t row_bytes = header.cols * sizeof(T);
+        for (size_t p = 0; p < panels; p++) {
+            {
+                std::unique_lock lock(mtx);
+                if (!cv.wait(lock, st, [&] { return p - consumed < bufs.size(); })) {
+                    return;
+                }
+            }
+            size_t row0 = p * panel_rows;
+            size_t rows = std::min(panel_rows, header.rows - row0);
+            off_t off = static_cast<off_t>(MATRIX_FILE_HEADER + row0 * row_bytes);
+            try {
+                pread_all(fd, bufs[p % bufs.size()].get(), rows * row_bytes, off, path);
+            } catch (...) {
+                std::lock_guard lock(mtx);
+                error = std::current_exception();
+                cv.notify_all();
+                return;
+            }
+            ::posix_fadvise(fd, off, static_cast<off_t>(rows * row_bytes), POSIX_FADV_DONTNEED);
+            {
+                std::lock_guard lock(mtx);
+                produced++;
+            }
+            cv.notify_all();
+        }
+    }
+
+    std::string path;
+    int fd = -1;
+    MatrixFileHeader header{};
+    size_t panel_rows;
+    size_t panels = 0;
+    std::vector<std::unique_ptr<T[]>> bufs;
+
+    std::mutex mtx;
+    std::condition_variable_any cv;
+    size_t produced = 0; // прочитано панелей
+    size_t taken = 0;    // отдано next()
+    size_t consumed = 0; // возвращено release()
+    std::exception_ptr error;
+
+    std::jthread reader;
+};
@@ -7,6 +7,15 @@
 #include <vector>
 #include <fstream>
 #include <thread>
+#include <cmath>
+#include <algorithm>
+#include "task_server.h"
+#include "mv_kernel.h"
+#include "spmv.h"
+#include "matrix_file.h"
+#include "aligned_buffer.h"
+#include "mv_device.h"
+#include "perf_counters.h"
 
 double cpuSecond()
 {
@@ -15,94 +24,917 @@ double cpuSecond()
     return ((double)ts.tv_sec + (double)ts.tv_nsec * 1.e-9);
 }
 
+// Эталон для проверки векторных ядер
 void matrix_vector_product(std::shared_ptr<double[]>a, 
                            std::shared_ptr<double[]>b, 
                            std::shared_ptr<double[]>c, 
                            size_t m, size_t n)
 {
-    for (int i = 0; i < m; i++)
-    {
-        c[i] = 0.0;
-        for (int j = 0; j < n; j++)
-            c[i] += a[i * n + j] * b[j];
-    }
+    mv_rows_scalar(a.get(), b.get(), c.get(), n, 0, m);
+}
+
+// Полоса строк потока threadid из nthreads при делении поровну; последний
+// берёт остаток
+void static_band(size_t m, int nthreads, int threadid, size_t& lb, size_t& ub)
+{
+    size_t items_per_thread = m / nthreads;
+    lb = threadid * items_per_thread;
+    ub = (threadid == nthreads - 1) ? m : (lb + items_per_thread);
 }
 
-void matrix_vector_product_omp(std::shared_ptr<double[]>a, 
+template <typename T>
+void matrix_vector_product_omp(std::shared_ptr<T[]>a, 
                                std::shared_ptr<double[]>b, 
                                std::shared_ptr<double[]>c, 
                                size_t m, size_t n,
-                               int nthreads, int threadid)
+                               int nthreads, int threadid,
+                               MvRowsFnT<T> kernel)
 {
     //int nthreads = omp_get_num_threads();
     //int threadid = omp_get_thread_num();
-    int items_per_thread = m / nthreads;
-    int lb = threadid * items_per_thread;
-    int ub = (threadid == nthreads - 1) ? (m - 1) : (lb + items_per_thread - 1);
+    size_t lb, ub;
+    static_band(m, nthreads, threadid, lb, ub);
     //std::cout << "Thread " << threadid << " working on " 
     //          << "(" << lb << ", " << ub << ")" << std::endl;
-    for (int i = lb; i <= ub; i++)
+    kernel(a.get(), b.get(), c.get(), n, lb, ub);
+}
+
+// Как строки делятся между потоками
+enum class RowSchedule
+{
+    Static,  // по одной равной полосе на поток
+    Dynamic, // куски по DYNAMIC_CHUNK строк с общего курсора
+    Guided,  // куски убывают: остаток / (2 * потоки), но не меньше GUIDED_MIN
+    OpenMP   // #pragma omp parallel for, расписание из OMP_SCHEDULE
+};
+
+const char* schedule_name(RowSchedule s)
+{
+    switch (s)
     {
-        c[i] = 0.0;
-        for (int j = 0; j < n; j++)
-            c[i] += a[i * n + j] * b[j];
+    case RowSchedule::Static: return "static";
+    case RowSchedule::Dynamic: return "dynamic";
+    case RowSchedule::Guided: return "guided";
+    default: return "openmp";
     }
 }
 
-double run_parallel(size_t n, size_t m, int k)
+// Кратны блоку строк векторных ядер, чтобы не было лишних остатков
+constexpr size_t DYNAMIC_CHUNK = 64;
+constexpr size_t GUIDED_MIN = 16;
+
+// Курсор следующей невыданной строки; свой кешлайн, чтобы захват куска не
+// задевал соседние данные
+struct alignas(64) RowCursor
 {
-    std::shared_ptr<double[]> a(new double[m * n]);
+    std::atomic<size_t> next{0};
+
+    // Следующий кусок [lb, ub); false — строки кончились
+    bool take(size_t m, int nthreads, bool guided, size_t& lb, size_t& ub)
+    {
+        if (!guided)
+        {
+            lb = next.fetch_add(DYNAMIC_CHUNK, std::memory_order_relaxed);
+            if (lb >= m)
+                return false;
+            ub = std::min(m, lb + DYNAMIC_CHUNK);
+            return true;
+        }
+        lb = next.load(std::memory_order_relaxed);
+        do
+        {
+            if (lb >= m)
+                return false;
+            size_t chunk = std::max(GUIDED_MIN, (m - lb) / (2 * nthreads));
+            ub = std::min(m, lb + chunk);
+        } while (!next.compare_exchange_weak(lb, ub, std::memory_order_relaxed));
+        return true;
+    }
+};
+
+// Поток берёт куски, пока строки не кончатся: поток, которого вытеснили
+// или посадили на занятое SMT-ядро, просто возьмёт меньше кусков
+template <typename T>
+void matrix_vector_product_dynamic(std::shared_ptr<T[]>a,
+                                   std::shared_ptr<double[]>b,
+                                   std::shared_ptr<double[]>c,
+                                   size_t m, size_t n, int nthreads,
+                                   RowCursor& cursor, bool guided,
+                                   MvRowsFnT<T> kernel)
+{
+    size_t lb, ub;
+    while (cursor.take(m, nthreads, guided, lb, ub))
+        kernel(a.get(), b.get(), c.get(), n, lb, ub);
+}
+
+#ifdef _OPENMP
+// Потоки OpenMP свои, не из пула; их привязку задают OMP_PROC_BIND/OMP_PLACES
+template <typename T>
+void matrix_vector_product_parallel_for(std::shared_ptr<T[]>a,
+                                        std::shared_ptr<double[]>b,
+                                        std::shared_ptr<double[]>c,
+                                        size_t m, size_t n, int nthreads,
+                                        MvRowsFnT<T> kernel)
+{
+    const T* pa = a.get();
+    const double* pb = b.get();
+    double* pc = c.get();
+    size_t blocks = (m + GUIDED_MIN - 1) / GUIDED_MIN;
+    #pragma omp parallel for schedule(runtime) num_threads(nthreads)
+    for (size_t blk = 0; blk < blocks; blk++)
+        kernel(pa, pb, pc, n, blk * GUIDED_MIN, std::min(m, (blk + 1) * GUIDED_MIN));
+}
+#endif
+
+// Режимы, доступные в этой сборке: OpenMP — только с -fopenmp
+std::vector<RowSchedule> available_schedules()
+{
+    std::vector<RowSchedule> v = {RowSchedule::Static, RowSchedule::Dynamic, RowSchedule::Guided};
+#ifdef _OPENMP
+    v.push_back(RowSchedule::OpenMP);
+#endif
+    return v;
+}
+
+// Время умножения и наибольшая относительная ошибка строки c
+struct RunStats
+{
+    double time; // среднее по запускам
+    double error;
+    double min = 0, median = 0, stddev = 0;
+    PerfCounts perf = {}; // на один запуск; valid ложно, если счётчиков нет
+};
+
+// Итог серии запусков: среднее, минимум, медиана и выборочное отклонение
+// времени, худшая ошибка
+RunStats summarize(const std::vector<RunStats>& runs)
+{
+    std::vector<double> t;
+    RunStats r{0, 0};
+    for (const RunStats& one : runs)
+    {
+        t.push_back(one.time);
+        r.time += one.time;
+        r.error = std::max(r.error, one.error);
+    }
+    size_t n = t.size();
+    r.time /= n;
+    std::sort(t.begin(), t.end());
+    r.min = t[0];
+    r.median = n % 2 ? t[n / 2] : (t[n / 2 - 1] + t[n / 2]) / 2;
+    for (double x : t)
+        r.stddev += (x - r.time) * (x - r.time);
+    r.stddev = n > 1 ? std::sqrt(r.stddev / (n - 1)) : 0.0;
+    return r;
+}
+
+// Байты из памяти и операции одного умножения — для roofline. a читается
+// один раз, b и c по разу на каждый вектор.
+struct Traffic
+{
+    double bytes, flops;
+};
+
+Traffic dense_traffic(size_t m, size_t n, size_t elem, size_t rhs = 1)
+{
+    return Traffic{double(m) * n * elem + double(m + n) * rhs * sizeof(double), 2.0 * m * n * rhs};
+}
+
+// Хвост строки results.csv: разброс времени, GB/s и GFLOP/s по медиане,
+// полоса STREAM на том же числе потоков, доля от неё и счётчики на запуск
+void write_metrics(std::ostream& out, const RunStats& r, Traffic w, double stream_gbs)
+{
+    double gbs = w.bytes / r.median * 1e-9;
+    out << "," << r.min << "," << r.median << "," << r.stddev << ","
+        << gbs << "," << w.flops / r.median * 1e-9 << "," << stream_gbs << "," << gbs / stream_gbs << ",";
+    if (r.perf.valid)
+        out << r.perf.cycles << "," << r.perf.instructions << "," << r.perf.llc_misses;
+    else
+        out << ",,";
+}
+
+// Для a[i][j] = i + j и b[j] = j ответ известен точно:
+// c[i] = i * sum(j) + sum(j^2). Целые до 2^53 в double точны, поэтому это
+// эталон и для double, и для узких форматов.
+double max_rel_error(const double* c, size_t m, size_t n)
+{
+    double s1 = double(n) * (n - 1) / 2;
+    double s2 = double(n) * (n - 1) * (2 * n - 1) / 6;
+    double err = 0;
+    for (size_t i = 0; i < m; i++)
+    {
+        double exact = i * s1 + s2;
+        err = std::max(err, std::fabs(c[i] - exact) / std::max(std::fabs(exact), 1.0));
+    }
+    return err;
+}
+
+// Буферы одного умножения: выделяются и заполняются один раз и служат
+// всем запускам точки перебора. a хранится в T; при rhs > 1 b и c — по
+// rhs столбцов в строке.
+template <typename T>
+struct DenseProblem
+{
+    size_t m, n, rhs;
+    std::shared_ptr<T[]> a;
+    std::shared_ptr<double[]> b, c;
+};
+
+// a[i][j] = i + j, b[j][r] = j + r. Обработчик i пула заполняет ту же
+// полосу строк a и c, что считает в static, — при привязке потоков
+// страницы полосы оказываются на его узле NUMA. b маленький и читается
+// всеми, его заполняет вызывающий поток.
+template <typename T>
+DenseProblem<T> make_dense(Server& pool, size_t n, size_t m, size_t rhs = 1)
+{
+    int k = pool.size();
+    DenseProblem<T> p{m, n, rhs, make_buffer<T>(m * n), make_buffer<double>(n * rhs),
+                      make_buffer<double>(m * rhs)};
+
+    for (size_t j = 0; j < n; j++)
+    {
+        for (size_t r = 0; r < rhs; r++)
+            p.b[j * rhs + r] = j + r;
+    }
+
+    auto part = [&](int i)
+    {
+        return [&, i]
+        {
+            size_t lb, ub;
+            static_band(m, k, i, lb, ub);
+            for (size_t row = lb; row < ub; row++)
+            {
+                for (size_t j = 0; j < n; j++)
+                    p.a[row * n + j] = narrow<T>(double(row + j));
+                for (size_t r = 0; r < rhs; r++)
+                    p.c[row * rhs + r] = 0.0;
+            }
+        };
+    };
+    std::vector<decltype(part(0))> parts;
+    for (int i = 0; i < k; i++)
+        parts.push_back(part(i));
+    for (auto& h : pool.add_tasks(std::span(parts)))
+        h.get();
+    return p;
+}
+
+// Одно умножение на пуле: k задач, каждая со своей полосой строк или
+// берущая куски с общего курсора. Обработчики живут между запусками,
+// поэтому здесь платим только за отправку задач.
+template <typename T>
+RunStats run_parallel(Server& pool, DenseProblem<T>& p, MvRowsFnT<T> kernel, RowSchedule schedule)
+{
+    int k = pool.size();
+    size_t m = p.m, n = p.n;
+    std::shared_ptr<T[]>& a = p.a;
+    std::shared_ptr<double[]>& b = p.b;
+    std::shared_ptr<double[]>& c = p.c;
+
+    RowCursor cursor;
+    bool guided = schedule == RowSchedule::Guided;
+    auto part = [&](int i)
+    {
+        return [&, i]
+        {
+            if (schedule == RowSchedule::Static)
+                matrix_vector_product_omp(a, b, c, m, n, k, i, kernel);
+            else
+                matrix_vector_product_dynamic(a, b, c, m, n, k, cursor, guided, kernel);
+        };
+    };
+    std::vector<decltype(part(0))> parts;
+    for (int i = 0; i < k; i++)
+        parts.push_back(part(i));
+
+    double t = cpuSecond();
+    std:: cout << "starting" << std::endl;
+#ifdef _OPENMP
+    if (schedule == RowSchedule::OpenMP)
+        matrix_vector_product_parallel_for(a, b, c, m, n, k, kernel);
+    else
+#endif
+    for (auto& h : pool.add_tasks(std::span(parts)))
+        h.get();
+
+    //matrix_vector_product_omp(a, b, c, m, n);
+    t = cpuSecond() - t;
+
+    printf("Elapsed time (parallel %d threads, %s): %.6f sec.\n", k, schedule_name(schedule), t);
+
+    return RunStats{t, max_rel_error(c.get(), m, n)};
+}
+
+// Накладные расходы отдельно от умножения
+struct Overhead
+{
+    double pool_start; // создание и запуск пула (один раз на число потоков)
+    double spawn;      // создать и дождаться k пустых std::thread — прежняя цена запуска
+    double dispatch;   // отправить k пустых задач в пул и дождаться их
+};
+
+// Среднее время и худшая ошибка за runs запусков на одних и тех же буферах
+template <typename T>
+RunStats avg_time_parallel(Server& pool, DenseProblem<T>& p, int runs, MvRowsFnT<T> kernel,
+                           RowSchedule schedule)
+{
+#ifdef _OPENMP
+    // Счётчики видят только уже созданные потоки: команда OpenMP должна
+    // появиться до их открытия
+    if (schedule == RowSchedule::OpenMP)
+        run_parallel<T>(pool, p, kernel, schedule);
+#endif
+    std::vector<RunStats> all;
+    PerfCounters counters;
+    counters.start();
+    for (int i = 0; i < runs; i++)
+        all.push_back(run_parallel<T>(pool, p, kernel, schedule));
+    PerfCounts perf = counters.stop();
+
+    RunStats total = summarize(all);
+    if (perf.valid)
+    {
+        total.perf = perf;
+        total.perf.cycles /= runs;
+        total.perf.instructions /= runs;
+        total.perf.llc_misses /= runs;
+    }
+    return total;
+}
+
+// Вызывает f(T{}) с типом хранения s
+template <typename F>
+auto visit_storage(Storage s, F&& f)
+{
+    switch (s)
+    {
+    case Storage::Float: return f(float{});
+    case Storage::Bf16: return f(bf16{});
+    case Storage::Fp16: return f(fp16{});
+    default: return f(double{});
+    }
+}
+
+RunStats avg_time_storage(Server& pool, size_t n, size_t m, int runs, MvKernel kernel,
+                          Storage storage, RowSchedule schedule)
+{
+    return visit_storage(storage, [&](auto tag)
+    {
+        using T = decltype(tag);
+        DenseProblem<T> p = make_dense<T>(pool, n, m);
+        return avg_time_parallel<T>(pool, p, runs, kernel_fn<T>(kernel), schedule);
+    });
+}
+
+Overhead measure_overhead(Server& pool, double pool_start, int runs)
+{
+    int k = pool.size();
+    Overhead o{pool_start, 0, 0};
+    for (int r = 0; r < runs; r++)
+    {
+        double t = cpuSecond();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < k; i++)
+            threads.emplace_back([] {});
+        for (auto& th : threads)
+            th.join();
+        o.spawn += cpuSecond() - t;
+
+        auto noop = [] {};
+        std::vector<decltype(noop)> noops(k, noop);
+        t = cpuSecond();
+        for (auto& h : pool.add_tasks(std::span(noops)))
+            h.get();
+        o.dispatch += cpuSecond() - t;
+    }
+    o.spawn /= runs;
+    o.dispatch /= runs;
+    return o;
+}
+
+// Полоса памяти по STREAM triad (a = b + s * c) на обработчиках пула. Три
+// массива по 128 МБ — больше любого LLC, заполнены по полосам static, как
+// матрица. Лучшее из runs; байт 24 на элемент, как считает STREAM (без
+// write-allocate).
+constexpr size_t STREAM_N = size_t(1) << 24;
+
+double stream_triad(Server& pool, int runs)
+{
+    int k = pool.size();
+    std::shared_ptr<double[]> a = make_buffer<double>(STREAM_N);
+    std::shared_ptr<double[]> b = make_buffer<double>(STREAM_N);
+    std::shared_ptr<double[]> c = make_buffer<double>(STREAM_N);
+    bool init = true;
+    auto part = [&](int i)
+    {
+        return [&, i]
+        {
+            size_t lb, ub;
+            static_band(STREAM_N, k, i, lb, ub);
+            if (init)
+            {
+                for (size_t j = lb; j < ub; j++)
+                {
+                    a[j] = 0.0;
+                    b[j] = 1.0;
+                    c[j] = 2.0;
+                }
+                return;
+            }
+            for (size_t j = lb; j < ub; j++)
+                a[j] = b[j] + 3.0 * c[j];
+        };
+    };
+    std::vector<decltype(part(0))> parts;
+    for (int i = 0; i < k; i++)
+        parts.push_back(part(i));
+
+    for (auto& h : pool.add_tasks(std::span(parts)))
+        h.get();
+    init = false;
+    double best = 0;
+    for (int r = 0; r < runs; r++)
+    {
+        double t = cpuSecond();
+        for (auto& h : pool.add_tasks(std::span(parts)))
+            h.get();
+        t = cpuSecond() - t;
+        best = r == 0 ? t : std::min(best, t);
+    }
+    return 3.0 * sizeof(double) * STREAM_N / best * 1e-9;
+}
+
+struct SweepResult
+{
+    std::vector<RunStats> stats; // по режиму из schedules
+    Overhead overhead;
+    double stream_gbs;
+};
+
+// Пул на k обработчиков живёт все runs запусков всех режимов для этого k
+SweepResult sweep_point(size_t M, size_t N, int k, int runs, Affinity pinning, MvKernel kernel,
+                        Storage storage, const std::vector<RowSchedule>& schedules)
+{
+    double t = cpuSecond();
+    Server pool(k, SchedulerMode::GlobalQueue, pinning);
+    pool.start();
+    double pool_start = cpuSecond() - t;
+
+    SweepResult r;
+    r.stream_gbs = stream_triad(pool, runs);
+    printf("%d threads: STREAM triad %.2f GB/s\n", k, r.stream_gbs);
+
+    // Буферы одни на все режимы; заполнены по полосам static
+    visit_storage(storage, [&](auto tag)
+    {
+        using T = decltype(tag);
+        DenseProblem<T> p = make_dense<T>(pool, M, N);
+        for (RowSchedule s : schedules)
+            r.stats.push_back(avg_time_parallel<T>(pool, p, runs, kernel_fn<T>(kernel), s));
+    });
+    r.overhead = measure_overhead(pool, pool_start, runs);
+    printf("%d threads: pool start %.1f us, spawn+join %.1f us, dispatch %.1f us\n", k,
+           r.overhead.pool_start * 1e6, r.overhead.spawn * 1e6, r.overhead.dispatch * 1e6);
+    return r;
+}
+
+// a на rhs векторов сразу: столбцы b и c идут подряд в строке (n x rhs и
+// m x rhs). Полосы строк статические: каждая задача заново читает весь b,
+// и чем длиннее полоса, тем меньше эта доля трафика по отношению к a.
+double run_parallel_multi(Server& pool, DenseProblem<double>& p, MmRowsFn kernel)
+{
+    int k = pool.size();
+    size_t rhs = p.rhs;
+    auto part = [&](int i)
+    {
+        return [&, i]
+        {
+            size_t lb, ub;
+            static_band(p.m, k, i, lb, ub);
+            kernel(p.a.get(), p.b.get(), p.c.get(), p.n, rhs, lb, ub);
+        };
+    };
+    std::vector<decltype(part(0))> parts;
+    for (int i = 0; i < k; i++)
+        parts.push_back(part(i));
+
+    double t = cpuSecond();
+    for (auto& h : pool.add_tasks(std::span(parts)))
+        h.get();
+    t = cpuSecond() - t;
+
+    printf("Elapsed time (parallel %d threads, %zu vectors): %.6f sec.\n", k, rhs, t);
+
+    return t;
+}
+
+// Сверка результата с ядром на один вектор: столбец r из b считается им
+// отдельно, и с ним сравнивается столбец r из c. Ошибка относительная, как
+// у max_rel_error.
+double multi_rhs_error(Server& pool, const DenseProblem<double>& p, size_t r, MvRowsFn single)
+{
+    int k = pool.size();
+    std::vector<double> b(p.n), ref(p.m);
+    for (size_t j = 0; j < p.n; j++)
+        b[j] = p.b[j * p.rhs + r];
+
+    auto part = [&](int i)
+    {
+        return [&, i]
+        {
+            size_t lb, ub;
+            static_band(p.m, k, i, lb, ub);
+            single(p.a.get(), b.data(), ref.data(), p.n, lb, ub);
+        };
+    };
+    std::vector<decltype(part(0))> parts;
+    for (int i = 0; i < k; i++)
+        parts.push_back(part(i));
+    for (auto& h : pool.add_tasks(std::span(parts)))
+        h.get();
+
+    double err = 0;
+    for (size_t i = 0; i < p.m; i++)
+        err = std::max(err, std::fabs(p.c[i * p.rhs + r] - ref[i]) / std::max(std::fabs(ref[i]), 1.0));
+    return err;
+}
+
+// Ошибка — по последнему столбцу после всех запусков против single
+RunStats avg_time_multi(Server& pool, size_t n, size_t m, size_t rhs, int runs, MmRowsFn kernel,
+                        MvRowsFn single)
+{
+    DenseProblem<double> p = make_dense<double>(pool, n, m, rhs);
+    std::vector<RunStats> all;
+    for (int i = 0; i < runs; i++)
+        all.push_back(RunStats{run_parallel_multi(pool, p, kernel), 0});
+    RunStats s = summarize(all);
+    s.error = multi_rhs_error(pool, p, rhs - 1, single);
+    return s;
+}
+
+#ifdef _OPENACC
+// Умножение на ускорителе: upload — копирование a и b, один раз на все
+// запуски; kernel и download (c обратно) — в среднем на запуск
+struct DeviceStats
+{
+    double upload, kernel, download, error;
+};
+
+template <typename T>
+DeviceStats avg_time_device(DenseProblem<T>& p, int runs)
+{
+    DeviceProblem<T> dev(p.a.get(), p.b.get(), p.c.get(), p.m, p.n);
+    DeviceStats s{dev.upload_time(), 0, 0, 0};
+    for (int i = 0; i < runs; i++)
+    {
+        s.kernel += dev.multiply();
+        s.download += dev.download();
+        s.error = std::max(s.error, max_rel_error(p.c.get(), p.m, p.n));
+    }
+    s.kernel /= runs;
+    s.download /= runs;
+
+    printf("Elapsed time (device, %zu x %zu): upload %.6f, kernel %.6f, download %.6f sec.\n",
+           p.m, p.n, s.upload, s.kernel, s.download);
+    return s;
+}
+#endif
+
+// Сверяет ядро с эталоном на матрице m x n. Порядок суммирования у ядер
+// разный, поэтому сравнение с допуском относительно суммы модулей. Эталон
+// читает те же округлённые до T элементы, так что допуск от T не зависит.
+template <typename T>
+bool check_kernel(size_t m, size_t n, MvRowsFnT<T> kernel)
+{
+    std::shared_ptr<T[]> a(new T[m * n]);
     std::shared_ptr<double[]> b(new double[n]);
     std::shared_ptr<double[]> c(new double[m]);
+    std::shared_ptr<double[]> ref(new double[m]);
 
-    if (a == NULL || b == NULL || c == NULL)
+    for (size_t i = 0; i < m; i++)
     {
-        std::cout << "Error allocate memory!\n" << std::endl;
-        exit(1);
+        for (size_t j = 0; j < n; j++)
+            a[i * n + j] = narrow<T>(std::sin(double(i + 1) * (j + 1)));
     }
+    for (size_t j = 0; j < n; j++)
+        b[j] = std::cos(double(j));
+
+    mv_rows_scalar<T>(a.get(), b.get(), ref.get(), n, 0, m);
+    kernel(a.get(), b.get(), c.get(), n, 0, m);
 
     for (size_t i = 0; i < m; i++)
     {
+        double scale = 0;
         for (size_t j = 0; j < n; j++)
-            a[i * n + j] = i + j;
+            scale += std::fabs(widen(a[i * n + j]) * b[j]);
+        if (std::fabs(c[i] - ref[i]) > 1e-13 * scale + 1e-300)
+        {
+            printf("Kernel mismatch at row %zu (%s): %.17g vs %.17g\n", i,
+                   storage_name(storage_of<T>()), c[i], ref[i]);
+            return false;
+        }
     }
+    return true;
+}
 
+// Матрица из файла, отображённого mmap: ни копирования, ни заполнения перед
+// замером. Первый запуск платит за страничные промахи, если файла нет в
+// страничном кеше.
+template <typename T>
+RunStats run_mapped(Server& pool, const MappedMatrix& mat, MvRowsFnT<T> kernel)
+{
+    int k = pool.size();
+    size_t m = mat.rows(), n = mat.cols();
+    const T* a = mat.data<T>();
+    std::vector<double> b(n), c(m);
     for (size_t j = 0; j < n; j++)
         b[j] = j;
 
-    std::vector<std::thread> threads;
+    auto part = [&](int i)
+    {
+        return [&, i]
+        {
+            size_t lb, ub;
+            static_band(m, k, i, lb, ub);
+            kernel(a, b.data(), c.data(), n, lb, ub);
+        };
+    };
+    std::vector<decltype(part(0))> parts;
+    for (int i = 0; i < k; i++)
+        parts.push_back(part(i));
 
     double t = cpuSecond();
-    std:: cout << "starting" << std::endl;
+    for (auto& h : pool.add_tasks(std::span(parts)))
+        h.get();
+    t = cpuSecond() - t;
+    return RunStats{t, max_rel_error(c.data(), m, n)};
+}
+
+// Панель строк при потоковом чтении: около 64 МБ, но не меньше 4 строк
+// на обработчик
+size_t stream_panel_rows(size_t n, size_t elem, int workers)
+{
+    return std::max<size_t>(4 * workers, (64 << 20) / std::max<size_t>(1, n * elem));
+}
+
+// Потоковое чтение: панель делится между обработчиками, пока следующая
+// читается с диска. В замер входит весь проход, с открытием файла.
+template <typename T>
+RunStats run_stream(Server& pool, const std::string& path, MvRowsFnT<T> kernel, size_t panel_rows)
+{
+    int k = pool.size();
+    double t = cpuSecond();
+    PanelStream<T> in(path, panel_rows);
+    size_t m = in.rows(), n = in.cols();
+    std::vector<double> b(n), c(m);
+    for (size_t j = 0; j < n; j++)
+        b[j] = j;
+
+    typename PanelStream<T>::Panel p;
+    auto part = [&](int i)
+    {
+        return [&, i]
+        {
+            size_t lb, ub;
+            static_band(p.rows, k, i, lb, ub);
+            kernel(p.data, b.data(), c.data() + p.row0, n, lb, ub);
+        };
+    };
+    std::vector<decltype(part(0))> parts;
     for (int i = 0; i < k; i++)
+        parts.push_back(part(i));
+
+    while (in.next(p))
     {
-        threads.emplace_back(
-            std::thread(matrix_vector_product_omp,a,b,c,m,n,k,i)
-        );
+        for (auto& h : pool.add_tasks(std::span(parts)))
+            h.get();
+        in.release();
     }
+    t = cpuSecond() - t;
+    return RunStats{t, max_rel_error(c.data(), m, n)};
+}
 
-    for (int i = 0; i < k; i++)
+// Файл матрицы m x n с a[i][j] = i + j в формате storage; уже лежащий
+// файл с теми же размерами и форматом используется как есть
+void ensure_matrix_file(const std::string& path, size_t m, size_t n, Storage storage)
+{
+    MatrixFileHeader h;
+    if (read_matrix_header(path, h) && h.rows == m && h.cols == n &&
+        h.storage == static_cast<uint32_t>(storage))
+        return;
+    printf("Writing %zu x %zu %s matrix to %s\n", m, n, storage_name(storage), path.c_str());
+    visit_storage(storage, [&](auto tag)
+    {
+        using T = decltype(tag);
+        write_matrix_file<T>(path, m, n, [&](size_t row0, size_t rows, T* dst)
+        {
+            for (size_t i = 0; i < rows; i++)
+            {
+                for (size_t j = 0; j < n; j++)
+                    dst[i * n + j] = narrow<T>(double(row0 + i + j));
+            }
+        });
+    });
+}
+
+// Файл по аргументам M и N перебора должен совпасть с плотной матрицей
+// make_dense(M, N) — N строк по M столбцов, — иначе speedup строк mmap и
+// stream считался бы от другой формы. Ответ обоих режимов сверяется с
+// плотным тем же ядром; M != N, чтобы перепутанный порядок был виден.
+template <typename T>
+bool check_file_input(Server& pool, const std::string& path, size_t M, size_t N, MvRowsFnT<T> kernel)
+{
+    DenseProblem<T> dense = make_dense<T>(pool, M, N);
+    kernel(dense.a.get(), dense.b.get(), dense.c.get(), dense.n, 0, dense.m);
+    double expected = max_rel_error(dense.c.get(), dense.m, dense.n);
+
+    ensure_matrix_file(path, N, M, storage_of<T>());
+    bool ok;
     {
-        threads[i].join();
+        MappedMatrix mapped(path);
+        RunStats rm = run_mapped<T>(pool, mapped, kernel);
+        RunStats rs = run_stream<T>(pool, path, kernel, stream_panel_rows(M, sizeof(T), pool.size()));
+        ok = mapped.rows() == dense.m && mapped.cols() == dense.n && rm.error == expected && rs.error == expected;
+        if (!ok)
+            printf("File input mismatch (%s): %zu x %zu file vs %zu x %zu dense, error %g / %g vs %g\n",
+                   storage_name(storage_of<T>()), mapped.rows(), mapped.cols(), dense.m, dense.n,
+                   rm.error, rs.error, expected);
     }
+    std::remove(path.c_str());
+    return ok;
+}
 
-    //matrix_vector_product_omp(a, b, c, m, n);
+// Разреженная матрица в плотном виде: a[i][j] = i + j там, где хеш (i, j)
+// ниже порога, иначе 0. Порог растёт по строкам от 0 до 2 * density: в
+// среднем доля ненулевых density, но строки неравные, как в настоящих
+// задачах, и деление по числу строк даёт перекос.
+std::shared_ptr<double[]> sparse_dense(size_t m, size_t n, double density)
+{
+    std::shared_ptr<double[]> a(new double[m * n]);
+    for (size_t i = 0; i < m; i++)
+    {
+        double p = std::min(1.0, 2 * density * (i + 0.5) / m);
+        uint64_t limit = static_cast<uint64_t>(p * 18446744073709551615.0);
+        for (size_t j = 0; j < n; j++)
+        {
+            // splitmix64
+            uint64_t z = (i * n + j) + 0x9E3779B97F4A7C15ull;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            z ^= z >> 31;
+            a[i * n + j] = z < limit ? double(i + j) : 0.0;
+        }
+    }
+    return a;
+}
+
+enum class SparseFormat
+{
+    Csr,
+    Sell
+};
+
+const char* format_name(SparseFormat f)
+{
+    return f == SparseFormat::Csr ? "csr" : "sell";
+}
+
+// σ для SELL: окно сортировки в 32 куска
+constexpr size_t SELL_SIGMA = 32 * SellMatrix::C;
+
+// Разреженная матрица в обоих форматах и эталонный ответ для x[j] = j
+struct SparseProblem
+{
+    double density;
+    CsrMatrix csr;
+    SellMatrix sell;
+    std::vector<double> x, ref;
+};
+
+SparseProblem make_sparse(size_t m, size_t n, double density, MvRowsFn dense_kernel)
+{
+    SparseProblem p;
+    p.density = density;
+    p.x.resize(n);
+    for (size_t j = 0; j < n; j++)
+        p.x[j] = j;
+    p.ref.resize(m);
+
+    std::shared_ptr<double[]> a = sparse_dense(m, n, density);
+    dense_kernel(a.get(), p.x.data(), p.ref.data(), n, 0, m);
+    p.csr = CsrMatrix::from_dense(a.get(), m, n);
+    p.sell = SellMatrix::from_csr(p.csr, SELL_SIGMA);
+    return p;
+}
+
+// Одно SpMV на пуле. by_nnz — полосы по числу ненулевых (у SELL — по
+// хранимым элементам с дополнением), иначе поровну строк (кусков).
+// Деление считается до замера: оно одно на матрицу и число потоков.
+RunStats run_sparse(Server& pool, const SparseProblem& p, SparseFormat format, bool by_nnz,
+                    SellChunksFn sell_kernel)
+{
+    int k = pool.size();
+    std::vector<size_t> bounds;
+    if (format == SparseFormat::Csr)
+        bounds = by_nnz ? split_by_weight(p.csr.row_ptr, k) : split_even(p.csr.m, k);
+    else
+        bounds = by_nnz ? split_by_weight(p.sell.chunk_ptr, k) : split_even(p.sell.chunks(), k);
+
+    std::vector<double> y(p.csr.m);
+    auto part = [&](int i)
+    {
+        return [&, i]
+        {
+            if (format == SparseFormat::Csr)
+                spmv_csr_rows(p.csr, p.x.data(), y.data(), bounds[i], bounds[i + 1]);
+            else
+                sell_kernel(p.sell, p.x.data(), y.data(), bounds[i], bounds[i + 1]);
+        };
+    };
+    std::vector<decltype(part(0))> parts;
+    for (int i = 0; i < k; i++)
+        parts.push_back(part(i));
+
+    double t = cpuSecond();
+    for (auto& h : pool.add_tasks(std::span(parts)))
+        h.get();
     t = cpuSecond() - t;
 
-    printf("Elapsed time (parallel %d threads): %.6f sec.\n", k, t);
+    double err = 0;
+    for (size_t i = 0; i < y.size(); i++)
+        err = std::max(err, std::fabs(y[i] - p.ref[i]) / std::max(std::fabs(p.ref[i]), 1.0));
+    return RunStats{t, err};
+}
 
-    return t;
+// Трафик умножения в разреженном формате: значения и индексы всех
+// хранимых элементов (у SELL — с дополнением), указатели строк или
+// кусков, x и y по разу. Операции — только над ненулевыми.
+Traffic sparse_traffic(const SparseProblem& p, SparseFormat format)
+{
+    size_t elem = sizeof(double) + sizeof(uint32_t);
+    double vectors = double(p.csr.m + p.csr.n) * sizeof(double);
+    double flops = 2.0 * p.csr.nnz();
+    if (format == SparseFormat::Csr)
+        return Traffic{p.csr.nnz() * elem + (p.csr.m + 1) * sizeof(size_t) + vectors, flops};
+    return Traffic{p.sell.stored() * elem + p.sell.chunks() * (sizeof(size_t) + sizeof(uint32_t)) +
+                   p.csr.m * sizeof(uint32_t) + vectors, flops};
 }
 
-double avg_time_parallel(size_t n, size_t m, int k, int runs)
+// CSR и SELL против плотного эталона: порядок ненулевых слагаемых в строке
+// тот же, но векторное ядро SELL складывает через FMA
+bool check_sparse(size_t m, size_t n, double density, SellChunksFn sell_kernel)
 {
-    double time = 0;
-    for (int i = 0; i < runs; i++)
+    SparseProblem p = make_sparse(m, n, density, mv_rows_scalar<double>);
+    std::vector<double> y_csr(m), y_sell(m);
+    spmv_csr_rows(p.csr, p.x.data(), y_csr.data(), 0, m);
+    sell_kernel(p.sell, p.x.data(), y_sell.data(), 0, p.sell.chunks());
+    for (size_t i = 0; i < m; i++)
     {
-        time += run_parallel(n,m,k);
+        double tol = 1e-13 * std::max(std::fabs(p.ref[i]), 1.0);
+        if (std::fabs(y_csr[i] - p.ref[i]) > tol || std::fabs(y_sell[i] - p.ref[i]) > tol)
+        {
+            printf("Sparse mismatch at row %zu: csr %.17g, sell %.17g vs %.17g\n",
+                   i, y_csr[i], y_sell[i], p.ref[i]);
+            return false;
+        }
     }
+    return true;
+}
+
+// То же для нескольких правых частей
+bool check_multi_kernel(size_t m, size_t n, size_t rhs, MmRowsFn kernel)
+{
+    std::shared_ptr<double[]> a(new double[m * n]);
+    std::shared_ptr<double[]> b(new double[n * rhs]);
+    std::shared_ptr<double[]> c(new double[m * rhs]);
+    std::shared_ptr<double[]> ref(new double[m * rhs]);
+
+    for (size_t i = 0; i < m * n; i++)
+        a[i] = std::sin(double(i + 1));
+    for (size_t i = 0; i < n * rhs; i++)
+        b[i] = std::cos(double(i));
 
-    return time / runs;
+    mm_rows_scalar(a.get(), b.get(), ref.get(), n, rhs, 0, m);
+    kernel(a.get(), b.get(), c.get(), n, rhs, 0, m);
+
+    for (size_t i = 0; i < m; i++)
+    {
+        for (size_t r = 0; r < rhs; r++)
+        {
+            double scale = 0;
+            for (size_t j = 0; j < n; j++)
+                scale += std::fabs(a[i * n + j] * b[j * rhs + r]);
+            double got = c[i * rhs + r], want = ref[i * rhs + r];
+            if (std::fabs(got - want) > 1e-13 * scale + 1e-300)
+            {
+                printf("Multi kernel mismatch at (%zu, %zu), %zu vectors: %.17g vs %.17g\n",
+                       i, r, rhs, got, want);
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
 /*
@@ -146,22 +978,251 @@ int main(int argc, char *argv[])
         M = atoi(argv[1]);
     if (argc > 2)
         N = atoi(argv[2]);
+    // Привязка потоков: none | core | node (потоки чередуются по узлам NUMA)
+    Affinity pinning = argc > 3 ? parse_affinity(argv[3]) : Affinity::None;
+    printf("Affinity: %s, NUMA nodes: %u\n", affinity_name(pinning), cpu_topology().node_count());
+    // Ядро: auto | scalar | avx2 | avx512 | neon; недоступное заменяется лучшим
+    MvKernel kernel = resolve_kernel(argc > 4 ? parse_kernel(argv[4]) : MvKernel::Auto);
+    // Хранение a: double | float | bf16 | fp16
+    Storage storage = argc > 5 ? parse_storage(argv[5]) : Storage::Double;
+    // Файл матрицы для режимов mmap и stream; без него они не запускаются
+    std::string matrix_path = argc > 6 ? argv[6] : "";
+    printf("Kernel: %s, storage: %s\n", kernel_name(kernel), storage_name(storage));
+
+    // Неровные размеры задевают хвосты строк и остаток блока строк
+    Storage storages[] = {Storage::Double, Storage::Float, Storage::Bf16, Storage::Fp16};
+    for (Storage st : storages)
+    {
+        for (size_t sz : {1, 3, 7, 33, 131})
+        {
+            bool ok = visit_storage(st, [&](auto tag)
+            {
+                using T = decltype(tag);
+                return check_kernel<T>(sz + 2, sz, kernel_fn<T>(kernel));
+            });
+            if (!ok)
+                return 1;
+        }
+    }
+    SellChunksFn sell_f = sell_kernel_fn(kernel);
+    // 37 строк — последний кусок SELL неполный; σ больше числа строк
+    for (double density : {0.0, 0.05, 0.3, 1.0})
+    {
+        if (!check_sparse(37, 53, density, sell_f) || !check_sparse(301, 41, density, sell_f))
+            return 1;
+    }
+    MmRowsFn multi_f = multi_kernel_fn(kernel);
+    // n = 700 даёт несколько блоков столбцов уже при 24 векторах
+    for (size_t rhs : {1, 2, 5, 8, 13, 24, 64})
+    {
+        for (size_t sz : {3, 33, 700})
+        {
+            if (!check_multi_kernel(7, sz, rhs, multi_f))
+                return 1;
+        }
+    }
+    if (!matrix_path.empty())
+    {
+        Server check_pool(2, SchedulerMode::GlobalQueue, pinning);
+        check_pool.start();
+        bool ok = visit_storage(storage, [&](auto tag)
+        {
+            using T = decltype(tag);
+            return check_file_input<T>(check_pool, matrix_path + ".check", 53, 37, kernel_fn<T>(kernel));
+        });
+        if (!ok)
+            return 1;
+    }
 
-    int threads[] = {2,4,7,8,16,20,40};
-    double single_thread_time = avg_time_parallel(M, N, 1, runs);
-    double time;
+    int threads[] = {1,2,4,7,8,16,20,40};
+    std::vector<RowSchedule> schedules = available_schedules();
+    // Ускорение всех режимов считается от static на одном потоке
+    double single_thread_time = 0;
+    // STREAM по числу потоков из threads — потолок для строк с тем же числом
+    std::vector<double> stream_gbs;
 
     std::ofstream out_file;
     out_file.open("results.csv");
 
-    out_file << "threads" << "," << "time" << "," << "speedup" << std::endl;
-    out_file << 1 << "," << single_thread_time << "," << 1 << std::endl;
+    out_file << "kernel" << "," << "storage" << "," << "format" << "," << "density" << "," << "schedule" << "," << "threads" << "," << "rhs" << ","
+             << "time" << "," << "speedup" << "," << "max_rel_error" << ","
+             << "pool_start" << "," << "spawn_overhead" << "," << "dispatch_overhead" << ","
+             << "min_time" << "," << "median_time" << "," << "stddev" << "," << "gbs" << "," << "gflops" << ","
+             << "stream_gbs" << "," << "bw_fraction" << "," << "cycles" << "," << "instructions" << ","
+             << "llc_misses" << std::endl;
 
     for (int tr : threads)
     {
-        time = avg_time_parallel(M, N, tr, runs);
-        out_file << tr << "," << time << "," << single_thread_time / time << std::endl;
+        SweepResult r = sweep_point(M, N, tr, runs, pinning, kernel, storage, schedules);
+        if (tr == 1)
+            single_thread_time = r.stats[0].time;
+        stream_gbs.push_back(r.stream_gbs);
+        for (size_t s = 0; s < schedules.size(); s++)
+        {
+            out_file << kernel_name(kernel) << "," << storage_name(storage) << "," << "dense" << "," << 1 << ","
+                     << schedule_name(schedules[s]) << "," << tr << "," << 1 << ","
+                     << r.stats[s].time << "," << single_thread_time / r.stats[s].time << ","
+                     << r.stats[s].error << ","
+                     << r.overhead.pool_start << "," << r.overhead.spawn << ","
+                     << r.overhead.dispatch;
+            write_metrics(out_file, r.stats[s], dense_traffic(N, M, storage_size(storage)), r.stream_gbs);
+            out_file << std::endl;
+        }
+    }
+
+    // Матрица с диска на тех же числах потоков: mmap — отображённый файл,
+    // stream — чтение панелями параллельно со счётом. speedup — от плотного
+    // static на одном потоке.
+    if (!matrix_path.empty())
+    {
+        ensure_matrix_file(matrix_path, N, M, storage);
+        double t = cpuSecond();
+        MappedMatrix mapped(matrix_path);
+        printf("Mapped %s in %.1f us\n", matrix_path.c_str(), (cpuSecond() - t) * 1e6);
+        for (size_t ti = 0; ti < std::size(threads); ti++)
+        {
+            int tr = threads[ti];
+            Server pool(tr, SchedulerMode::GlobalQueue, pinning);
+            pool.start();
+            for (const char* input : {"mmap", "stream"})
+            {
+                std::vector<RunStats> all;
+                for (int i = 0; i < runs; i++)
+                {
+                    all.push_back(visit_storage(storage, [&](auto tag)
+                    {
+                        using T = decltype(tag);
+                        if (input[0] == 'm')
+                            return run_mapped<T>(pool, mapped, kernel_fn<T>(kernel));
+                        size_t panel = stream_panel_rows(M, sizeof(T), tr);
+                        return run_stream<T>(pool, matrix_path, kernel_fn<T>(kernel), panel);
+                    }));
+                }
+                RunStats r = summarize(all);
+                out_file << kernel_name(kernel) << "," << storage_name(storage) << "," << input << ","
+                         << 1 << "," << "static" << "," << tr << "," << 1 << ","
+                         << r.time << "," << single_thread_time / r.time << "," << r.error << ",,,";
+                write_metrics(out_file, r, dense_traffic(N, M, storage_size(storage)), stream_gbs[ti]);
+                out_file << std::endl;
+            }
+        }
+    }
+
+    // Разреженные форматы на тех же числах потоков. schedule: static —
+    // поровну строк (кусков SELL), nnz — поровну ненулевых. speedup — от
+    // плотного static на одном потоке, чтобы видеть, с какой плотности
+    // разреженный путь выгоднее.
+    for (double density : {0.001, 0.01, 0.1})
+    {
+        SparseProblem p = make_sparse(N, M, density, kernel_fn<double>(kernel));
+        printf("Density %g: %zu nonzeros, SELL-%zu-%zu stores %zu (%.1f%% padding)\n", density,
+               p.csr.nnz(), SellMatrix::C, p.sell.sigma, p.sell.stored(),
+               p.csr.nnz() ? 100.0 * (p.sell.stored() - p.csr.nnz()) / p.csr.nnz() : 0.0);
+        for (size_t ti = 0; ti < std::size(threads); ti++)
+        {
+            int tr = threads[ti];
+            Server pool(tr, SchedulerMode::GlobalQueue, pinning);
+            pool.start();
+            for (SparseFormat format : {SparseFormat::Csr, SparseFormat::Sell})
+            {
+                for (bool by_nnz : {false, true})
+                {
+                    std::vector<RunStats> all;
+                    for (int i = 0; i < runs; i++)
+                        all.push_back(run_sparse(pool, p, format, by_nnz, sell_f));
+                    RunStats r = summarize(all);
+                    out_file << kernel_name(kernel) << "," << "double" << "," << format_name(format) << ","
+                             << density << "," << (by_nnz ? "nnz" : "static") << "," << tr << "," << 1 << ","
+                             << r.time << "," << single_thread_time / r.time << "," << r.error << ",,,";
+                    write_metrics(out_file, r, sparse_traffic(p, format), stream_gbs[ti]);
+                    out_file << std::endl;
+                }
+            }
+        }
+    }
+
+    // Кривые ниже — на всех процессорах. Проход по a с инициализацией
+    // дорог, поэтому запусков меньше.
+    int multi_threads = std::max(1u, std::thread::hardware_concurrency());
+    int multi_runs = std::max(1, runs / 3);
+    Server multi_pool(multi_threads, SchedulerMode::GlobalQueue, pinning);
+    multi_pool.start();
+    double multi_stream = stream_triad(multi_pool, runs);
+
+    // Форматы хранения: speedup — t(double) / t(формат), ошибка — против
+    // точного ответа
+    double double_time = 0;
+    for (Storage st : storages)
+    {
+        RunStats r = avg_time_storage(multi_pool, M, N, multi_runs, kernel, st, RowSchedule::Dynamic);
+        if (st == Storage::Double)
+            double_time = r.time;
+        printf("%s: %.6f sec, max relative error %.3g\n", storage_name(st), r.time, r.error);
+        out_file << kernel_name(kernel) << "," << storage_name(st) << "," << "dense" << "," << 1 << "," << "dynamic" << ","
+                 << multi_threads << "," << 1 << "," << r.time << "," << double_time / r.time << ","
+                 << r.error << ",,,";
+        write_metrics(out_file, r, dense_traffic(N, M, storage_size(st)), multi_stream);
+        out_file << std::endl;
+    }
+
+    // Кривая по числу векторов. speedup здесь — во сколько раз быстрее на
+    // вектор, чем rhs отдельных умножений: rhs * t(1) / t(rhs). Не все rhs.
+    // Ошибка — расхождение с ядром на один вектор.
+    double one_rhs_time = 0;
+    for (size_t rhs : {1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64})
+    {
+        RunStats r = avg_time_multi(multi_pool, M, N, rhs, multi_runs, multi_f, kernel_fn<double>(kernel));
+        if (rhs == 1)
+            one_rhs_time = r.time;
+        out_file << kernel_name(kernel) << "," << "double" << "," << "dense" << "," << 1 << "," << "static" << "," << multi_threads << ","
+                 << rhs << "," << r.time << "," << rhs * one_rhs_time / r.time << "," << r.error << ",,,";
+        write_metrics(out_file, r, dense_traffic(N, M, sizeof(double), rhs), multi_stream);
+        out_file << std::endl;
+    }
+
+#ifdef _OPENACC
+    // Ускоритель против всех процессоров на квадратных матрицах от 256 до
+    // размера M x N. speedup — t(cpu) / (kernel + download): a уже на
+    // устройстве. breakeven_runs — сколько запусков на одной матрице
+    // окупают её копирование; пусто, если ускоритель не быстрее.
+    if (device_available())
+    {
+        std::ofstream offload_file("offload_results.csv");
+        offload_file << "storage" << "," << "rows" << "," << "cols" << "," << "bytes" << "," << "cpu_threads" << ","
+                     << "cpu_time" << "," << "upload" << "," << "kernel" << "," << "download" << ","
+                     << "speedup" << "," << "breakeven_runs" << "," << "max_rel_error" << std::endl;
+
+        std::vector<std::pair<size_t, size_t>> sizes;
+        for (size_t sz = 256; sz * sz < M * N; sz *= 2)
+            sizes.push_back({sz, sz});
+        sizes.push_back({N, M}); // как в плотном переборе: N строк по M столбцов
+        Storage device_storage = storage == Storage::Float ? Storage::Float : Storage::Double;
+        for (auto [rows, cols] : sizes)
+        {
+            visit_storage(device_storage, [&](auto tag)
+            {
+                using T = decltype(tag);
+                if constexpr (device_storage_v<T>)
+                {
+                    DenseProblem<T> p = make_dense<T>(multi_pool, cols, rows);
+                    RunStats cpu = avg_time_parallel<T>(multi_pool, p, multi_runs, kernel_fn<T>(kernel),
+                                                        RowSchedule::Static);
+                    DeviceStats dev = avg_time_device<T>(p, multi_runs);
+                    double per_run = dev.kernel + dev.download;
+                    offload_file << storage_name(device_storage) << "," << rows << "," << cols << ","
+                                 << rows * cols * sizeof(T) << "," << multi_threads << ","
+                                 << cpu.time << "," << dev.upload << "," << dev.kernel << "," << dev.download << ","
+                                 << cpu.time / per_run << ",";
+                    if (per_run < cpu.time)
+                        offload_file << std::ceil(dev.upload / (cpu.time - per_run));
+                    offload_file << "," << std::max(cpu.error, dev.error) << std::endl;
+                }
+            });
+        }
     }
+    else
+        printf("No accelerator, offload curve skipped\n");
+#endif
 
     return 0;
 }
@@ -0,0 +1,103 @@
+// Умножение матрицы на вектор на ускорителе через OpenACC (nvc++ -acc).
+// a и b копируются на устройство один раз и лежат там между запусками;
+// запуск — только ядро, результат c забирается отдельно. Так копирование
+// в обе стороны и счёт меряются порознь, и видно, с какого размера
+// матрицы перенос окупается.
+//
+// Без OpenACC (или без устройства — ядро тогда шло бы на хосте)
+// device_available() ложно и путь не запускается. Хранение — double и
+// float: преобразования bf16 и fp16 из mv_kernel.h на устройство не
+// вынесены.
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <type_traits>
+#ifdef _OPENACC
+#include <openacc.h>
+#endif
+
+inline double device_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline bool device_available() {
+#ifdef _OPENACC
+    return acc_get_num_devices(acc_device_not_host) > 0;
+#else
+    return false;
+#endif
+}
+
+template <typename T>
+constexpr bool device_storage_v = std::is_same_v<T, double> || std::is_same_v<T, float>;
+
+#ifdef _OPENACC
+
+// Копии a (m x n), b (n) и c (m) на устройстве на время жизни объекта.
+// Указатели — на буферы хоста; по ним же OpenACC находит копии.
+template <typename T>
+class DeviceProblem {
+    static_assert(device_storage_v<T>, "device kernel supports double and float storage");
+
+public:
+    DeviceProblem(const T* a, const double* b, double* c, size_t m, size_t n)
+        : a_(a), b_(b), c_(c), m_(m), n_(n) {
+        size_t len = m * n;
+        double t = device_seconds();
+#pragma acc enter data copyin(a[0:len], b[0:n]) create(c[0:m])
+        upload_ = device_seconds() - t;
+    }
+
+    ~DeviceProblem() {
+        const T* a = a_;
+        const double* b = b_;
+        double* c = c_;
+        size_t len = m_ * n_, n = n_, m = m_;
+#pragma acc exit data delete(a[0:len], b[0:n], c[0:m])
+    }
+
+    DeviceProblem(const DeviceProblem&) = delete;
+    DeviceProblem& operator=(const DeviceProblem&) = delete;
+
+    // Время copyin a и b
+    double upload_time() const { return upload_; }
+
+    // Одно умножение на устройстве; c остаётся там. Строка — на gang,
+    // её элементы — по vector: соседние нити читают соседние элементы a.
+    double multiply() {
+        const T* a = a_;
+        const double* b = b_;
+        double* c = c_;
+        size_t len = m_ * n_, n = n_, m = m_;
+        double t = device_seconds();
+#pragma acc parallel loop gang vector_length(128) present(a[0:len], b[0:n], c[0:m])
+        for (size_t i = 0; i < m; i++) {
+            double sum = 0.0;
+#pragma acc loop vector reduction(+:sum)
+            for (size_t j = 0; j < n; j++) {
+                sum += double(a[i * n + j]) * b[j];
+            }
+            c[i] = sum;
+        }
+        return device_seconds() - t;
+    }
+
+    // Копирует c с устройства в буфер хоста
+    double download() {
+        double* c = c_;
+        size_t m = m_;
+        double t = device_seconds();
+#pragma acc update self(c[0:m])
+        return device_seconds() - t;
+    }
+
+private:
+    const T* a_;
+    const double* b_;
+    double* c_;
+    size_t m_, n_;
+    double upload_ = 0;
+};
+
+#endif // _OPENACC
@@ -0,0 +1,773 @@
+// Ядра умножения полосы строк матрицы на вектор: c[i] = sum_j a[i*n + j] * b[j]
+// для i из [lb, ub). Скалярное ядро — эталон для проверки; векторные держат
+// суммы ROWS строк в регистрах, каждая загрузка b[j..] идёт на все ROWS
+// строк, и пишут c[i] один раз. Набор инструкций выбирается при запуске.
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MV_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define MV_NEON 1
+#endif
+
+enum class MvKernel {
+    Auto,   // лучшее из поддерживаемых процессором
+    Scalar,
+    Avx2,   // AVX2 + FMA
+    Avx512, // AVX-512F
+    Neon
+};
+
+inline const char* kernel_name(MvKernel k) {
+    switch (k) {
+    case MvKernel::Scalar: return "scalar";
+    case MvKernel::Avx2: return "avx2";
+    case MvKernel::Avx512: return "avx512";
+    case MvKernel::Neon: return "neon";
+    default: return "auto";
+    }
+}
+
+// "scalar" | "avx2" | "avx512" | "neon"; всё остальное — Auto
+inline MvKernel parse_kernel(const std::string& s) {
+    if (s == "scalar") {
+        return MvKernel::Scalar;
+    }
+    if (s == "avx2") {
+        return MvKernel::Avx2;
+    }
+    if (s == "avx512") {
+        return MvKernel::Avx512;
+    }
+    if (s == "neon") {
+        return MvKernel::Neon;
+    }
+    return MvKernel::Auto;
+}
+
+// Форматы хранения a. b, c и суммы всегда double: узкий формат уменьшает
+// только поток байт из памяти, ошибка округления — одна на элемент a.
+enum class Storage {
+    Double,
+    Float,
+    Bf16, // старшие 16 бит float: диапазон float, 8 бит мантиссы
+    Fp16  // IEEE half: 11 бит мантиссы, но |x| до 65504
+};
+
+inline const char* storage_name(Storage s) {
+    switch (s) {
+    case Storage::Float: return "float";
+    case Storage::Bf16: return "bf16";
+    case Storage::Fp16: return "fp16";
+    default: return "double";
+    }
+}
+
+// "float" | "bf16" | "fp16"; всё остальное — Double
+inline Storage parse_storage(const std::string& s) {
+    if (s == "float") {
+        return Storage::Float;
+    }
+    if (s == "bf16") {
+        return Storage::Bf16;
+    }
+    if (s == "fp16") {
+        return Storage::Fp16;
+    }
+    return Storage::Double;
+}
+
+// Половинные форматы — просто биты; отдельные типы, чтобы шаблоны ядер
+// различали их
+struct bf16 {
+    uint16_t bits;
+};
+
+struct fp16 {
+    uint16_t bits;
+};
+
+template <typename T>
+constexpr Storage storage_of() {
+    if constexpr (std::is_same_v<T, float>) {
+        return Storage::Float;
+    } else if constexpr (std::is_same_v<T, bf16>) {
+        return Storage::Bf16;
+    } else if constexpr (std::is_same_v<T, fp16>) {
+        return Storage::Fp16;
+    } else {
+        return Storage::Double;
+    }
+}
+
+// Байт на элемент
+inline size_t storage_size(Storage s) {
+    switch (s) {
+    case Storage::Float: return sizeof(float);
+    case Storage::Bf16: return sizeof(bf16);
+    case Storage::Fp16: return sizeof(fp16);
+    default: return sizeof(double);
+    }
+}
+
+inline double widen(double x) { return x; }
+inline float widen(float x) { return x; }
+
+inline float widen(bf16 x) {
+    return std::bit_cast<float>(uint32_t(x.bits) << 16);
+}
+
+inline float widen(fp16 x) {
+    uint32_t sign = uint32_t(x.bits & 0x8000) << 16;
+    uint32_t exp = (x.bits >> 10) & 0x1F;
+    uint32_t mant = x.bits & 0x3FF;
+    if (exp == 0) {
+        float v = std::ldexp(float(mant), -24);
+        return sign ? -v : v;
+    }
+    if (exp == 31) {
+        return std::bit_cast<float>(sign | 0x7F800000 | (mant << 13));
+    }
+    return std::bit_cast<float>(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+// Округление к ближайшему, при равенстве — к чётному
+template <typename T>
+T narrow(double x);
+
+template <>
+inline double narrow<double>(double x) { return x; }
+
+template <>
+inline float narrow<float>(double x) { return static_cast<float>(x); }
+
+template <>
+inline bf16 narrow<bf16>(double x) {
+    uint32_t u = std::bit_cast<uint32_t>(static_cast<float>(x));
+    if ((u & 0x7FFFFFFF) > 0x7F800000) {
+        return bf16{uint16_t((u >> 16) | 0x40)}; // NaN остаётся NaN
+    }
+    u += 0x7FFF + ((u >> 16) & 1);
+    return bf16{uint16_t(u >> 16)};
+}
+
+// Сначала в float, потом в half: двойное округление здесь безвредно для
+// погрешности порядка половины ulp half
+template <>
+inline fp16 narrow<fp16>(double x) {
+    uint32_t u = std::bit_cast<uint32_t>(static_cast<float>(x));
+    uint32_t sign = (u >> 16) & 0x8000;
+    uint32_t abs = u & 0x7FFFFFFF;
+    if (abs > 0x7F800000) {
+        return fp16{uint16_t(sign | 0x7E00)};
+    }
+    if (abs >= 0x477FF000) { // от 65520 и выше — бесконечность
+        return fp16{uint16_t(sign | 0x7C00)};
+    }
+    if (abs < 0x38800000) { // меньше 2^-14 — денормализованное half
+        float m = std::nearbyint(std::bit_cast<float>(abs) * 16777216.0f);
+        return fp16{uint16_t(sign | static_cast<uint32_t>(m))};
+    }
+    abs += 0xFFF + ((abs >> 13) & 1);
+    return fp16{uint16_t(sign | ((abs - 0x38000000) >> 13))};
+}
+
+template <typename T>
+using MvRowsFnT = void (*)(const T* a, const double* b, double* c,
+                           size_t n, size_t lb, size_t ub);
+using MvRowsFn = MvRowsFnT<double>;
+
+// Эталон: прямой порядок суммирования, сумма в локальной переменной
+template <typename T>
+inline void mv_rows_scalar(const T* a, const double* b, double* c,
+                           size_t n, size_t lb, size_t ub) {
+    for (size_t i = lb; i < ub; i++) {
+        const T* row = a + i * n;
+        double sum = 0.0;
+        for (size_t j = 0; j < n; j++) {
+            sum += widen(row[j]) * b[j];
+        }
+        c[i] = sum;
+    }
+}
+
+#ifdef MV_X86
+
+// Загрузка 4 элементов a с расширением до double. F16C есть у всех
+// процессоров с AVX2, поэтому ядро AVX2 им пользуется без отдельного режима.
+#define MV_AVX2_TARGET __attribute__((target("avx2,fma,f16c")))
+
+MV_AVX2_TARGET inline __m256d mv_load4(const double* p) { return _mm256_loadu_pd(p); }
+MV_AVX2_TARGET inline __m256d mv_load4(const float* p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+
+MV_AVX2_TARGET inline __m256d mv_load4(const bf16* p) {
+    __m128i w = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    return _mm256_cvtps_pd(_mm_castsi128_ps(_mm_slli_epi32(w, 16)));
+}
+
+MV_AVX2_TARGET inline __m256d mv_load4(const fp16* p) {
+    return _mm256_cvtps_pd(_mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+}
+
+MV_AVX2_TARGET inline double mv_hsum_avx2(__m256d v) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+template <typename T>
+MV_AVX2_TARGET inline void mv_rows_avx2(const T* a, const double* b, double* c,
+                                        size_t n, size_t lb, size_t ub) {
+    constexpr size_t ROWS = 4;
+    size_t nv = n & ~size_t(3);
+    size_t i = lb;
+    for (; i + ROWS <= ub; i += ROWS) {
+        const T* r0 = a + i * n;
+        const T* r1 = r0 + n;
+        const T* r2 = r1 + n;
+        const T* r3 = r2 + n;
+        __m256d s0 = _mm256_setzero_pd();
+        __m256d s1 = _mm256_setzero_pd();
+        __m256d s2 = _mm256_setzero_pd();
+        __m256d s3 = _mm256_setzero_pd();
+        for (size_t j = 0; j < nv; j += 4) {
+            __m256d bv = _mm256_loadu_pd(b + j);
+            s0 = _mm256_fmadd_pd(mv_load4(r0 + j), bv, s0);
+            s1 = _mm256_fmadd_pd(mv_load4(r1 + j), bv, s1);
+            s2 = _mm256_fmadd_pd(mv_load4(r2 + j), bv, s2);
+            s3 = _mm256_fmadd_pd(mv_load4(r3 + j), bv, s3);
+        }
+        double t0 = mv_hsum_avx2(s0), t1 = mv_hsum_avx2(s1);
+        double t2 = mv_hsum_avx2(s2), t3 = mv_hsum_avx2(s3);
+        for (size_t j = nv; j < n; j++) {
+            t0 += widen(r0[j]) * b[j];
+            t1 += widen(r1[j]) * b[j];
+            t2 += widen(r2[j]) * b[j];
+            t3 += widen(r3[j]) * b[j];
+        }
+        c[i] = t0;
+        c[i + 1] = t1;
+        c[i + 2] = t2;
+        c[i + 3] = t3;
+    }
+    // Оставшиеся строки по одной
+    for (; i < ub; i++) {
+        const T* r = a + i * n;
+        __m256d s = _mm256_setzero_pd();
+        for (size_t j = 0; j < nv; j += 4) {
+            s = _mm256_fmadd_pd(mv_load4(r + j), _mm256_loadu_pd(b + j), s);
+        }
+        double t = mv_hsum_avx2(s);
+        for (size_t j = nv; j < n; j++) {
+            t += widen(r[j]) * b[j];
+        }
+        c[i] = t;
+    }
+}
+
+// То же по 8 элементов. Хвост строки короче 8 для double берётся маской;
+// маскированная загрузка узких типов требует AVX-512BW/VL, поэтому у них
+// хвост скалярный.
+#define MV_AVX512_TARGET __attribute__((target("avx512f,f16c")))
+
+// _mm512_cvtps_pd и _mm512_extractf64x4_pd (а с ним _mm512_reduce_add_pd)
+// в GCC 12 берут проходное значение из _mm512_undefined_pd(), и на каждой
+// подстановке срабатывает -Wmaybe-uninitialized. Варианты maskz с полной
+// маской — те же инструкции, но проходное значение у них ноль.
+MV_AVX512_TARGET inline __m512d mv_widen8(__m256 v) { return _mm512_maskz_cvtps_pd(0xFF, v); }
+
+MV_AVX512_TARGET inline __m512d mv_load8(const double* p) { return _mm512_loadu_pd(p); }
+MV_AVX512_TARGET inline __m512d mv_load8(const float* p) { return mv_widen8(_mm256_loadu_ps(p)); }
+
+MV_AVX512_TARGET inline __m512d mv_load8(const bf16* p) {
+    __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    return mv_widen8(_mm256_castsi256_ps(_mm256_slli_epi32(w, 16)));
+}
+
+MV_AVX512_TARGET inline __m512d mv_load8(const fp16* p) {
+    return mv_widen8(_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+}
+
+// Порядок сложения тот же, что у _mm512_reduce_add_pd
+MV_AVX512_TARGET inline double mv_hsum_avx512(__m512d v) {
+    __m256d h = _mm256_add_pd(_mm512_maskz_extractf64x4_pd(0xFF, v, 1), _mm512_maskz_extractf64x4_pd(0xFF, v, 0));
+    __m128d s = _mm_add_pd(_mm256_extractf128_pd(h, 1), _mm256_castpd256_pd128(h));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+template <typename T>
+MV_AVX512_TARGET inline void mv_rows_avx512(const T* a, const double* b, double* c,
+                                            size_t n, size_t lb, size_t ub) {
+    constexpr size_t ROWS = 4;
+    constexpr bool masked = std::is_same_v<T, double>;
+    size_t nv = n & ~size_t(7);
+    __mmask8 tail = static_cast<__mmask8>((1u << (n - nv)) - 1);
+    size_t i = lb;
+    for (; i + ROWS <= ub; i += ROWS) {
+        const T* r0 = a + i * n;
+        const T* r1 = r0 + n;
+        const T* r2 = r1 + n;
+        const T* r3 = r2 + n;
+        __m512d s0 = _mm512_setzero_pd();
+        __m512d s1 = _mm512_setzero_pd();
+        __m512d s2 = _mm512_setzero_pd();
+        __m512d s3 = _mm512_setzero_pd();
+        for (size_t j = 0; j < nv; j += 8) {
+            __m512d bv = _mm512_loadu_pd(b + j);
+            s0 = _mm512_fmadd_pd(mv_load8(r0 + j), bv, s0);
+            s1 = _mm512_fmadd_pd(mv_load8(r1 + j), bv, s1);
+            s2 = _mm512_fmadd_pd(mv_load8(r2 + j), bv, s2);
+            s3 = _mm512_fmadd_pd(mv_load8(r3 + j), bv, s3);
+        }
+        if constexpr (masked) {
+            if (tail) {
+                __m512d bv = _mm512_maskz_loadu_pd(tail, b + nv);
+                s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, r0 + nv), bv, s0);
+                s1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, r1 + nv), bv, s1);
+                s2 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, r2 + nv), bv, s2);
+                s3 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, r3 + nv), bv, s3);
+            }
+        }
+        double t0 = mv_hsum_avx512(s0), t1 = mv_hsum_avx512(s1);
+        double t2 = mv_hsum_avx512(s2), t3 = mv_hsum_avx512(s3);
+        if constexpr (!masked) {
+            for (size_t j = nv; j < n; j++) {
+                t0 += widen(r0[j]) * b[j];
+                t1 += widen(r1[j]) * b[j];
+                t2 += widen(r2[j]) * b[j];
+                t3 += widen(r3[j]) * b[j];
+            }
+        }
+        c[i] = t0;
+        c[i + 1] = t1;
+        c[i + 2] = t2;
+        c[i + 3] = t3;
+    }
+    for (; i < ub; i++) {
+        const T* r = a + i * n;
+        __m512d s = _mm512_setzero_pd();
+        for (size_t j = 0; j < nv; j += 8) {
+            s = _mm512_fmadd_pd(mv_load8(r + j), _mm512_loadu_pd(b + j), s);
+        }
+        if constexpr (masked) {
+            if (tail) {
+                s = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, r + nv),
+                                    _mm512_maskz_loadu_pd(tail, b + nv), s);
+            }
+        }
+        double t = mv_hsum_avx512(s);
+        if constexpr (!masked) {
+            for (size_t j = nv; j < n; j++) {
+                t += widen(r[j]) * b[j];
+            }
+        }
+        c[i] = t;
+    }
+}
+
+#endif // MV_X86
+
+#ifdef MV_NEON
+
+// NEON входит в базовый AArch64: отдельной проверки при запуске не нужно.
+// Половинные форматы расширяются поэлементно: bf16 — это сдвиг, fp16 —
+// аппаратное преобразование __fp16.
+inline float64x2_t mv_load2(const double* p) { return vld1q_f64(p); }
+inline float64x2_t mv_load2(const float* p) { return vcvt_f64_f32(vld1_f32(p)); }
+
+inline float64x2_t mv_load2(const bf16* p) {
+    float32x2_t f = {widen(p[0]), widen(p[1])};
+    return vcvt_f64_f32(f);
+}
+
+inline float64x2_t mv_load2(const fp16* p) {
+    const __fp16* h = reinterpret_cast<const __fp16*>(p);
+    float32x2_t f = {float(h[0]), float(h[1])};
+    return vcvt_f64_f32(f);
+}
+
+template <typename T>
+inline void mv_rows_neon(const T* a, const double* b, double* c,
+                         size_t n, size_t lb, size_t ub) {
+    constexpr size_t ROWS = 4;
+    size_t nv = n & ~size_t(1);
+    size_t i = lb;
+    for (; i + ROWS <= ub; i += ROWS) {
+        const T* r0 = a + i * n;
+        const T* r1 = r0 + n;
+        const T* r2 = r1 + n;
+        const T* r3 = r2 + n;
+        float64x2_t s0 = vdupq_n_f64(0.0);
+        float64x2_t s1 = vdupq_n_f64(0.0);
+        float64x2_t s2 = vdupq_n_f64(0.0);
+        float64x2_t s3 = vdupq_n_f64(0.0);
+        for (size_t j = 0; j < nv; j += 2) {
+            float64x2_t bv = vld1q_f64(b + j);
+            s0 = vfmaq_f64(s0, mv_load2(r0 + j), bv);
+            s1 = vfmaq_f64(s1, mv_load2(r1 + j), bv);
+            s2 = vfmaq_f64(s2, mv_load2(r2 + j), bv);
+            s3 = vfmaq_f64(s3, mv_load2(r3 + j), bv);
+        }
+        double t0 = vaddvq_f64(s0), t1 = vaddvq_f64(s1);
+        double t2 = vaddvq_f64(s2), t3 = vaddvq_f64(s3);
+        if (nv < n) {
+            t0 += widen(r0[nv]) * b[nv];
+            t1 += widen(r1[nv]) * b[nv];
+            t2 += widen(r2[nv]) * b[nv];
+            t3 += widen(r3[nv]) * b[nv];
+        }
+        c[i] = t0;
+        c[i + 1] = t1;
+        c[i + 2] = t2;
+        c[i + 3] = t3;
+    }
+    for (; i < ub; i++) {
+        const T* r = a + i * n;
+        float64x2_t s = vdupq_n_f64(0.0);
+        for (size_t j = 0; j < nv; j += 2) {
+            s = vfmaq_f64(s, mv_load2(r + j), vld1q_f64(b + j));
+        }
+        double t = vaddvq_f64(s);
+        if (nv < n) {
+            t += widen(r[nv]) * b[nv];
+        }
+        c[i] = t;
+    }
+}
+
+#endif // MV_NEON
+
+// Поддерживает ли процессор ядро; Scalar и Auto есть всегда
+inline bool kernel_supported(MvKernel k) {
+    switch (k) {
+#ifdef MV_X86
+    case MvKernel::Avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+               __builtin_cpu_supports("f16c");
+    case MvKernel::Avx512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("f16c");
+#endif
+#ifdef MV_NEON
+    case MvKernel::Neon: return true;
+#endif
+    case MvKernel::Scalar:
+    case MvKernel::Auto: return true;
+    default: return false;
+    }
+}
+
+// Auto превращается в конкретное ядро; неподдерживаемое — в лучшее доступное
+inline MvKernel resolve_kernel(MvKernel k) {
+    if (k != MvKernel::Auto && kernel_supported(k)) {
+        return k;
+    }
+    for (MvKernel best : {MvKernel::Avx512, MvKernel::Avx2, MvKernel::Neon}) {
+        if (kernel_supported(best)) {
+            return best;
+        }
+    }
+    return MvKernel::Scalar;
+}
+
+template <typename T = double>
+inline MvRowsFnT<T> kernel_fn(MvKernel k) {
+    switch (resolve_kernel(k)) {
+#ifdef MV_X86
+    case MvKernel::Avx2: return mv_rows_avx2<T>;
+    case MvKernel::Avx512: return mv_rows_avx512<T>;
+#endif
+#ifdef MV_NEON
+    case MvKernel::Neon: return mv_rows_neon<T>;
+#endif
+    default: return mv_rows_scalar<T>;
+    }
+}
+
+// Несколько правых частей: c = a * b, где b — n x k, c — m x k, обе по
+// строкам. Элемент a[i][j] умножается сразу на всю строку b[j][0..k), так
+// что один проход по a обслуживает все k векторов. Строки и столбцы c
+// держатся в регистрах плиткой R x (ширина вектора * V); циклы по R и V
+// разворачиваются целиком, иначе плитка осталась бы массивом в памяти.
+using MmRowsFn = void (*)(const double* a, const double* b, double* c,
+                          size_t n, size_t k, size_t lb, size_t ub);
+
+// Столбцы a идут блоками: блок b (cols x k) около 128 КБ остаётся в L2,
+// пока над ним проходят все строки полосы
+inline size_t mm_col_block(size_t k) {
+    return std::max<size_t>(64, 16384 / k);
+}
+
+// Эталон: каждый элемент c — отдельное скалярное произведение
+inline void mm_rows_scalar(const double* a, const double* b, double* c,
+                           size_t n, size_t k, size_t lb, size_t ub) {
+    for (size_t i = lb; i < ub; i++) {
+        const double* row = a + i * n;
+        for (size_t r = 0; r < k; r++) {
+            double sum = 0.0;
+            for (size_t j = 0; j < n; j++) {
+                sum += row[j] * b[j * k + r];
+            }
+            c[i * k + r] = sum;
+        }
+    }
+}
+
+#ifdef MV_X86
+
+// Плитка R строк x V векторов по 4 столбца с c0; хвост столбцов маской.
+// first — первый блок столбцов a: суммы начинаются с нуля, а не с c.
+MV_AVX2_TARGET
+inline __m256i mm_mask_avx2(size_t left) {
+    long long w = left >= 4 ? 4 : static_cast<long long>(left);
+    return _mm256_cmpgt_epi64(_mm256_set1_epi64x(w), _mm256_setr_epi64x(0, 1, 2, 3));
+}
+
+template <size_t R, size_t V>
+MV_AVX2_TARGET
+inline void mm_tile_avx2(const double* a, const double* b, double* c, size_t n, size_t k,
+                         size_t i, size_t c0, size_t j0, size_t j1, bool first) {
+    __m256i mask[V];
+    __m256d s[R][V];
+    #pragma GCC unroll 8
+    for (size_t v = 0; v < V; v++) {
+        size_t col = c0 + 4 * v;
+        mask[v] = mm_mask_avx2(col < k ? k - col : 0);
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < R; r++) {
+            s[r][v] = first ? _mm256_setzero_pd() : _mm256_maskload_pd(c + (i + r) * k + col, mask[v]);
+        }
+    }
+    for (size_t j = j0; j < j1; j++) {
+        __m256d bv[V];
+        #pragma GCC unroll 8
+        for (size_t v = 0; v < V; v++) {
+            bv[v] = _mm256_maskload_pd(b + j * k + c0 + 4 * v, mask[v]);
+        }
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < R; r++) {
+            __m256d av = _mm256_broadcast_sd(a + (i + r) * n + j);
+            #pragma GCC unroll 8
+            for (size_t v = 0; v < V; v++) {
+                s[r][v] = _mm256_fmadd_pd(av, bv[v], s[r][v]);
+            }
+        }
+    }
+    #pragma GCC unroll 8
+    for (size_t r = 0; r < R; r++) {
+        #pragma GCC unroll 8
+        for (size_t v = 0; v < V; v++) {
+            _mm256_maskstore_pd(c + (i + r) * k + c0 + 4 * v, mask[v], s[r][v]);
+        }
+    }
+}
+
+template <size_t R>
+MV_AVX2_TARGET
+inline void mm_rowblock_avx2(const double* a, const double* b, double* c, size_t n, size_t k,
+                             size_t i, size_t j0, size_t j1) {
+    for (size_t c0 = 0; c0 < k; c0 += 8) {
+        if (k - c0 > 4) {
+            mm_tile_avx2<R, 2>(a, b, c, n, k, i, c0, j0, j1, j0 == 0);
+        } else {
+            mm_tile_avx2<R, 1>(a, b, c, n, k, i, c0, j0, j1, j0 == 0);
+        }
+    }
+}
+
+MV_AVX2_TARGET
+inline void mm_rows_avx2(const double* a, const double* b, double* c,
+                         size_t n, size_t k, size_t lb, size_t ub) {
+    if (k == 1) {
+        mv_rows_avx2(a, b, c, n, lb, ub);
+        return;
+    }
+    if (k == 0) {
+        return;
+    }
+    size_t nb = mm_col_block(k);
+    for (size_t j0 = 0; j0 < n; j0 += nb) {
+        size_t j1 = std::min(n, j0 + nb);
+        size_t i = lb;
+        for (; i + 4 <= ub; i += 4) {
+            mm_rowblock_avx2<4>(a, b, c, n, k, i, j0, j1);
+        }
+        for (; i < ub; i++) {
+            mm_rowblock_avx2<1>(a, b, c, n, k, i, j0, j1);
+        }
+    }
+}
+
+// То же на AVX-512: векторы по 8 столбцов, маски — встроенные __mmask8
+template <size_t R, size_t V>
+MV_AVX512_TARGET
+inline void mm_tile_avx512(const double* a, const double* b, double* c, size_t n, size_t k,
+                           size_t i, size_t c0, size_t j0, size_t j1, bool first) {
+    __mmask8 mask[V];
+    __m512d s[R][V];
+    #pragma GCC unroll 8
+    for (size_t v = 0; v < V; v++) {
+        size_t col = c0 + 8 * v;
+        size_t left = col < k ? k - col : 0;
+        mask[v] = static_cast<__mmask8>(left >= 8 ? 0xFF : (1u << left) - 1);
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < R; r++) {
+            s[r][v] = first ? _mm512_setzero_pd() : _mm512_maskz_loadu_pd(mask[v], c + (i + r) * k + col);
+        }
+    }
+    for (size_t j = j0; j < j1; j++) {
+        __m512d bv[V];
+        #pragma GCC unroll 8
+        for (size_t v = 0; v < V; v++) {
+            bv[v] = _mm512_maskz_loadu_pd(mask[v], b + j * k + c0 + 8 * v);
+        }
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < R; r++) {
+            __m512d av = _mm512_set1_pd(a[(i + r) * n + j]);
+            #pragma GCC unroll 8
+            for (size_t v = 0; v < V; v++) {
+                s[r][v] = _mm512_fmadd_pd(av, bv[v], s[r][v]);
+            }
+        }
+    }
+    #pragma GCC unroll 8
+    for (size_t r = 0; r < R; r++) {
+        #pragma GCC unroll 8
+        for (size_t v = 0; v < V; v++) {
+            _mm512_mask_storeu_pd(c + (i + r) * k + c0 + 8 * v, mask[v], s[r][v]);
+        }
+    }
+}
+
+template <size_t R>
+MV_AVX512_TARGET
+inline void mm_rowblock_avx512(const double* a, const double* b, double* c, size_t n, size_t k,
+                               size_t i, size_t j0, size_t j1) {
+    for (size_t c0 = 0; c0 < k; c0 += 16) {
+        if (k - c0 > 8) {
+            mm_tile_avx512<R, 2>(a, b, c, n, k, i, c0, j0, j1, j0 == 0);
+        } else {
+            mm_tile_avx512<R, 1>(a, b, c, n, k, i, c0, j0, j1, j0 == 0);
+        }
+    }
+}
+
+MV_AVX512_TARGET
+inline void mm_rows_avx512(const double* a, const double* b, double* c,
+                           size_t n, size_t k, size_t lb, size_t ub) {
+    if (k == 1) {
+        mv_rows_avx512(a, b, c, n, lb, ub);
+        return;
+    }
+    if (k == 0) {
+        return;
+    }
+    size_t nb = mm_col_block(k);
+    for (size_t j0 = 0; j0 < n; j0 += nb) {
+        size_t j1 = std::min(n, j0 + nb);
+        size_t i = lb;
+        for (; i + 4 <= ub; i += 4) {
+            mm_rowblock_avx512<4>(a, b, c, n, k, i, j0, j1);
+        }
+        for (; i < ub; i++) {
+            mm_rowblock_avx512<1>(a, b, c, n, k, i, j0, j1);
+        }
+    }
+}
+
+#endif // MV_X86
+
+#ifdef MV_NEON
+
+// Плитка R строк x 4 столбца; без масок, поэтому последние k % 4 столбцов
+// считаются скалярно
+template <size_t R>
+inline void mm_tile_neon(const double* a, const double* b, double* c, size_t n, size_t k,
+                         size_t i, size_t c0, size_t j0, size_t j1, bool first) {
+    float64x2_t s[R][2];
+    #pragma GCC unroll 8
+    for (size_t r = 0; r < R; r++) {
+        const double* cr = c + (i + r) * k + c0;
+        s[r][0] = first ? vdupq_n_f64(0.0) : vld1q_f64(cr);
+        s[r][1] = first ? vdupq_n_f64(0.0) : vld1q_f64(cr + 2);
+    }
+    for (size_t j = j0; j < j1; j++) {
+        float64x2_t b0 = vld1q_f64(b + j * k + c0);
+        float64x2_t b1 = vld1q_f64(b + j * k + c0 + 2);
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < R; r++) {
+            float64x2_t av = vdupq_n_f64(a[(i + r) * n + j]);
+            s[r][0] = vfmaq_f64(s[r][0], av, b0);
+            s[r][1] = vfmaq_f64(s[r][1], av, b1);
+        }
+    }
+    #pragma GCC unroll 8
+    for (size_t r = 0; r < R; r++) {
+        double* cr = c + (i + r) * k + c0;
+        vst1q_f64(cr, s[r][0]);
+        vst1q_f64(cr + 2, s[r][1]);
+    }
+}
+
+template <size_t R>
+inline void mm_rowblock_neon(const double* a, const double* b, double* c, size_t n, size_t k,
+                             size_t i, size_t j0, size_t j1) {
+    size_t kv = k & ~size_t(3);
+    for (size_t c0 = 0; c0 < kv; c0 += 4) {
+        mm_tile_neon<R>(a, b, c, n, k, i, c0, j0, j1, j0 == 0);
+    }
+    #pragma GCC unroll 8
+    for (size_t r = 0; r < R; r++) {
+        const double* row = a + (i + r) * n;
+        for (size_t col = kv; col < k; col++) {
+            double sum = j0 == 0 ? 0.0 : c[(i + r) * k + col];
+            for (size_t j = j0; j < j1; j++) {
+                sum += row[j] * b[j * k + col];
+            }
+            c[(i + r) * k + col] = sum;
+        }
+    }
+}
+
+inline void mm_rows_neon(const double* a, const double* b, double* c,
+                         size_t n, size_t k, size_t lb, size_t ub) {
+    if (k == 1) {
+        mv_rows_neon(a, b, c, n, lb, ub);
+        return;
+    }
+    if (k == 0) {
+        return;
+    }
+    size_t nb = mm_col_block(k);
+    for (size_t j0 = 0; j0 < n; j0 += nb) {
+        size_t j1 = std::min(n, j0 + nb);
+        size_t i = lb;
+        for (; i + 4 <= ub; i += 4) {
+            mm_rowblock_neon<4>(a, b, c, n, k, i, j0, j1);
+        }
+        for (; i < ub; i++) {
+            mm_rowblock_neon<1>(a, b, c, n, k, i, j0, j1);
+        }
+    }
+}
+
+#endif // MV_NEON
+
+inline MmRowsFn multi_kernel_fn(MvKernel k) {
+    switch (resolve_kernel(k)) {
+#ifdef MV_X86
+    case MvKernel::Avx2: return mm_rows_avx2;
+    case MvKernel::Avx512: return mm_rows_avx512;
+#endif
+#ifdef MV_NEON
+    case MvKernel::Neon: return mm_rows_neon;
+#endif
+    default: return mm_rows_scalar;
+    }
+}
@@ -0,0 +1,231 @@
+#include "task_server.h"
+#include <fstream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Стоимость одной задачи в бенчмарке
+enum class TaskCost
+{
+    Sq,
+    Sqrt,
+    Sin,
+    Smthlse,
+    Spin100,
+    Spin1000
+};
+
+const char* cost_name(TaskCost c)
+{
+    switch (c)
+    {
+    case TaskCost::Sq: return "f_sq";
+    case TaskCost::Sqrt: return "f_sqrt";
+    case TaskCost::Sin: return "f_sin";
+    case TaskCost::Smthlse: return "f_smthlse";
+    case TaskCost::Spin100: return "spin100";
+    default: return "spin1000";
+    }
+}
+
+const char* mode_name(SchedulerMode m)
+{
+    switch (m)
+    {
+    case SchedulerMode::GlobalQueue: return "global";
+    case SchedulerMode::WorkStealing: return "steal";
+    case SchedulerMode::LockFreeRing: return "ring";
+    case SchedulerMode::Priority: return "prio";
+    default: return "numa";
+    }
+}
+
+// Искусственная нагрузка: n итераций, которые компилятор не выбросит
+int spin(int x, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        x = x * 1103515245 + 12345;
+        asm volatile("" : "+r"(x));
+    }
+    return x;
+}
+
+int run_cost(TaskCost c, int x)
+{
+    switch (c)
+    {
+    case TaskCost::Sq: return f_sq<int>(x);
+    case TaskCost::Sqrt: return f_sqrt<int>(x);
+    case TaskCost::Sin: return f_sin<int>(x);
+    case TaskCost::Smthlse: return f_smthlse<int>(x, x, x);
+    case TaskCost::Spin100: return spin(x, 100);
+    default: return spin(x, 1000);
+    }
+}
+
+// Задача возвращает момент своего завершения; задержка считается
+// производителем как завершение минус момент отправки пачки
+struct BenchTask
+{
+    TaskCost cost;
+    int arg;
+
+    uint64_t operator()() const
+    {
+        int r = run_cost(cost, arg);
+        asm volatile("" : : "r"(r));
+        return now_ns();
+    }
+};
+
+struct BenchConfig
+{
+    SchedulerMode mode;
+    Affinity pinning;
+    unsigned producers;
+    unsigned workers;
+    TaskCost cost;
+    size_t batch;
+};
+
+struct BenchResult
+{
+    size_t tasks; // выполнено: запрошенное, округлённое вниз до кратного producers
+    double time;
+    double tasks_per_sec;
+    LatencySnapshot latency;
+};
+
+// Задач в полёте на одного производителя: без окна задержка мерила бы
+// ожидание всего накопленного хвоста, а не работу очереди
+constexpr size_t WINDOW = 1024;
+
+struct InFlight
+{
+    uint64_t submitted;
+    std::vector<TaskHandle<uint64_t>> handles;
+};
+
+void producer(Server& server, const BenchConfig& cfg, size_t tasks, LatencyHistogram& hist)
+{
+    std::vector<BenchTask> funcs;
+    std::deque<InFlight> in_flight;
+    size_t pending = 0;
+
+    auto collect = [&]()
+    {
+        InFlight& f = in_flight.front();
+        for (auto& h : f.handles)
+        {
+            uint64_t finished = h.get();
+            hist.record(finished > f.submitted ? finished - f.submitted : 0);
+        }
+        pending -= f.handles.size();
+        in_flight.pop_front();
+    };
+
+    for (size_t done = 0; done < tasks;)
+    {
+        size_t n = std::min(cfg.batch, tasks - done);
+        funcs.clear();
+        for (size_t i = 0; i < n; i++)
+            funcs.push_back(BenchTask{cfg.cost, static_cast<int>(done + i)});
+
+        uint64_t t = now_ns();
+        if (n == 1)
+            in_flight.push_back(InFlight{t, {server.add_task(funcs[0])}});
+        else
+            in_flight.push_back(InFlight{t, server.add_tasks(std::span(funcs))});
+        pending += n;
+        done += n;
+
+        while (pending > WINDOW)
+            collect();
+    }
+    while (!in_flight.empty())
+        collect();
+}
+
+BenchResult run_bench(const BenchConfig& cfg, size_t total_tasks)
+{
+    Server server(cfg.workers, cfg.mode, cfg.pinning);
+    server.start();
+
+    std::vector<LatencyHistogram> hists(cfg.producers);
+    std::vector<std::thread> threads;
+    size_t per_producer = total_tasks / cfg.producers;
+
+    double t = now_ns();
+    for (unsigned i = 0; i < cfg.producers; i++)
+        threads.emplace_back(producer, std::ref(server), std::cref(cfg), per_producer, std::ref(hists[i]));
+    for (auto& th : threads)
+        th.join();
+    t = (now_ns() - t) * 1e-9;
+
+    server.stop();
+
+    BenchResult res;
+    res.tasks = per_producer * cfg.producers;
+    res.time = t;
+    res.tasks_per_sec = res.tasks / t;
+    for (auto& h : hists)
+        res.latency.merge(h.snapshot());
+    return res;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t tasks = 30000;
+    std::string out_name = "server_results.csv";
+    if (argc > 1)
+        tasks = atoi(argv[1]);
+    if (argc > 2)
+        out_name = argv[2];
+    Affinity pinning = argc > 3 ? parse_affinity(argv[3]) : Affinity::None;
+
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> worker_counts = {1};
+    for (unsigned w = 2; w < hw; w *= 2)
+        worker_counts.push_back(w);
+    if (hw > 1)
+        worker_counts.push_back(hw);
+
+    SchedulerMode modes[] = {SchedulerMode::GlobalQueue, SchedulerMode::WorkStealing,
+                             SchedulerMode::LockFreeRing, SchedulerMode::Priority,
+                             SchedulerMode::Numa};
+    unsigned producer_counts[] = {1, 2, 4};
+    TaskCost costs[] = {TaskCost::Sq, TaskCost::Sqrt, TaskCost::Sin,
+                        TaskCost::Smthlse, TaskCost::Spin100, TaskCost::Spin1000};
+    size_t batches[] = {1, 16, 256};
+
+    std::ofstream out_file;
+    out_file.open(out_name);
+
+    out_file << "mode" << "," << "affinity" << "," << "producers" << "," << "workers" << "," << "task" << ","
+             << "batch" << "," << "tasks" << "," << "time" << "," << "tasks_per_sec" << ","
+             << "p50_us" << "," << "p99_us" << "," << "p999_us" << std::endl;
+
+    for (SchedulerMode mode : modes)
+        for (unsigned producers : producer_counts)
+            for (unsigned workers : worker_counts)
+                for (TaskCost cost : costs)
+                    for (size_t batch : batches)
+                    {
+                        BenchConfig cfg{mode, pinning, producers, workers, cost, batch};
+                        BenchResult r = run_bench(cfg, tasks);
+
+                        printf("%s producers=%u workers=%u %s batch=%zu: %.0f tasks/s, p99 %.1f us\n",
+                               mode_name(mode), producers, workers, cost_name(cost), batch,
+                               r.tasks_per_sec, r.latency.percentile(0.99) / 1000.0);
+
+                        out_file << mode_name(mode) << "," << affinity_name(pinning) << "," << producers << "," << workers << ","
+                                 << cost_name(cost) << "," << batch << "," << r.tasks << ","
+                                 << r.time << "," << r.tasks_per_sec << ","
+                                 << r.latency.percentile(0.5) / 1000.0 << ","
+                                 << r.latency.percentile(0.99) / 1000.0 << ","
+                                 << r.latency.percentile(0.999) / 1000.0 << std::endl;
+                    }
+
+    return 0;
+}
@@ -1,243 +1,333 @@
-#include <iostream>
-#include <queue>
-#include <future>
-#include <thread>
-#include <chrono>
-#include <cmath>
-#include <cassert>
-#include <functional>
-#include <mutex>
-#include <condition_variable>
-#include <unordered_map>
-#include <map>
-#include <any>
-#include <atomic>
-#include <tuple>
-#include <stop_token>
-
-// Forward declaration
-class TaskWrapperBase;
-
-// Очередь задач
-std::queue<int> tasks;
-std::unordered_map<int, std::unique_ptr<TaskWrapperBase>> results;
-std::mutex mut;
-std::condition_variable cond_var;
-std::atomic<int> nextid{0};
-std::jthread server_thread_obj;
-
-// Base class for type erasure
-class TaskWrapperBase {
-public:
-    virtual ~TaskWrapperBase() = default;
-    virtual void execute() = 0;
-    virtual std::any get_result() = 0;
-};
-
-template<typename F, typename... Args>
-class TaskWrapper : public TaskWrapperBase {
-    F func;
-    std::tuple<Args...> args;
-    std::any result;
-    std::mutex mtx;
-    std::condition_variable cv;
-    bool ready = false;
-
-public:
-    TaskWrapper(F f, Args... as) 
-        : func(std::move(f)), args(std::forward<Args>(as)...) {}
-
-    void execute() override {
-        auto res = std::apply(func, args);
-        {
-            std::lock_guard<std::mutex> lock(mtx);
-            result = std::move(res);
-            ready = true;
-        }
-        cv.notify_all();
-    }
+#include "task_server.h"
+#include "task_net.h"
+#include <csignal>
 
-    std::any get_result() override {
-        std::unique_lock<std::mutex> lock(mtx);
-        cv.wait(lock, [this]() { return ready; });
-        return result;
-    }
-
-    bool is_ready() const {
-        return ready;
-    }
-};
+void client(Server& server, int N)
+{
+    std::vector<std::pair<TaskHandle<int>, int>> expected;
 
-void server_thread(std::stop_token stoken) {
-    int task_id;
-    std::unique_lock<std::mutex> lock(mut, std::defer_lock);
+    while (N > 0)
+    {
+        int arg1 = rand();
+        int arg2 = rand();
+        int arg3 = rand();
 
-    while (!stoken.stop_requested()) {
-        lock.lock();
-        cond_var.wait(lock, [&stoken] { 
-            return !tasks.empty() || stoken.stop_requested(); 
-        });
+        expected.emplace_back(server.add_task(f_sq<int>, arg1), arg1 * arg1);
+        expected.emplace_back(server.add_task(f_sqrt<int>, arg2), std::sqrt(arg2));
+        expected.emplace_back(server.add_task(f_sin<int>, arg3), std::sin(arg3));
         
-        if (stoken.stop_requested()) {
-            break;
-        }
+        N -= 3;
+    }
 
-        if (!tasks.empty()) {
-            task_id = tasks.front();
-            tasks.pop();
-            lock.unlock();
-        
-            auto it = results.find(task_id);
-            if (it != results.end()) {
-                it->second->execute();
-            }
+    
+    for (auto& [handle, value] : expected)
+    {
+        int result = server.request_result(handle);
+        if (result != value)
+        {
+            std::cout << result << " != " << value << std::endl;
+            exit(13);
+            //throw std::exception("Wrong result");
         }
     }
-    std::cout << "Server stop!\n";
+    
 }
 
-class Server {
-private:
-    std::jthread server_t;
-
-public:
-    Server() = default;
-    ~Server() { stop(); }
+// Тот же набор задач, но пачками через add_tasks / request_results
+void client_batched(Server& server, int N, size_t batch)
+{
+    auto call = [](int (*f)(int), int x) { return [f, x] { return f(x); }; };
+    using Call = decltype(call(f_sq<int>, 0));
 
-    void start() {
-        server_t = std::jthread(server_thread);
-    }
-    
-    void stop() {
-        if (server_t.joinable()) {
-            server_t.request_stop();
-            cond_var.notify_all();
-        }
-    }
-};
+    std::vector<Call> funcs;
+    std::vector<int> expected;
 
-template<typename F, typename... Args>
-int add_task(F&& func, Args&&... args) {
-    using WrapperType = TaskWrapper<std::decay_t<F>, std::decay_t<Args>...>;
-        
-    int task_id = nextid++;
+    while (N > 0)
     {
-        std::lock_guard<std::mutex> lock(mut);
-        results[task_id] = std::make_unique<WrapperType>(
-            std::forward<F>(func), 
-            std::forward<Args>(args)...
-        );
-        tasks.push(task_id);
-    }
-    cond_var.notify_one();
-    return task_id;
-}
+        funcs.clear();
+        expected.clear();
+        while (funcs.size() < batch && N > 0)
+        {
+            int arg1 = rand();
+            int arg2 = rand();
+            int arg3 = rand();
 
-template<typename T>
-T request_result(int task_id) {
-    std::unique_ptr<TaskWrapperBase> task;
-    
-    auto it = results.find(task_id);    
-    if (it == results.end()) {
-        throw std::runtime_error("Task ID not found");
-    }
+            funcs.push_back(call(f_sq<int>, arg1));
+            funcs.push_back(call(f_sqrt<int>, arg2));
+            funcs.push_back(call(f_sin<int>, arg3));
 
-    T res = std::any_cast<T>(it->second->get_result());
+            expected.push_back(arg1 * arg1);
+            expected.push_back(std::sqrt(arg2));
+            expected.push_back(std::sin(arg3));
 
-    {
-        std::lock_guard<std::mutex> lock(mut);
-        task = std::move(it->second);
-        results.erase(it);
-    }
+            N -= 3;
+        }
 
-    return res;
+        auto handles = server.add_tasks(std::span(funcs), Priority::Bulk);
+        std::vector<int> results = server.request_results(std::span(handles));
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            if (results[i] != expected[i])
+            {
+                std::cout << results[i] << " != " << expected[i] << std::endl;
+                exit(13);
+            }
+        }
+    }
 }
 
-template<typename T>
-T f_sq(T x) 
+// Клиент-корутина: десятки тысяч ожиданий без потока на каждое
+CoTask<long long> co_client(Server& server, int N)
 {
-    //std::this_thread::sleep_for(std::chrono::seconds(2));
-    return x * x;
+    co_await server.schedule();
+    long long sum = 0;
+    for (int i = 0; i < N; i++)
+    {
+        sum += co_await server.submit(f_sq<int>, i);
+        if (i % 16 == 0)
+            co_await server.schedule(); // уступаем обработчик
+    }
+    co_return sum;
 }
 
-template<typename T>
-T f_sqrt(T x) 
+// Функции, доступные удалённым клиентам
+FunctionRegistry make_registry()
 {
-    //std::this_thread::sleep_for(std::chrono::seconds(1));
-    return std::sqrt(x);
+    FunctionRegistry reg;
+    reg.add("f_sq", f_sq<long long>);
+    reg.add("f_sqrt", f_sqrt<long long>);
+    reg.add("f_sin", f_sin<long long>);
+    reg.add("f_smthlse", f_smthlse<long long>);
+    return reg;
 }
 
-template<typename T>
-T f_sin(T x) 
+// server_client serve <port> [workers]: принимает задачи по сети до SIGINT/SIGTERM
+int serve_main(int argc, char *argv[])
 {
-    //std::this_thread::sleep_for(std::chrono::seconds(2));
-    return std::sin(x);
-}
+    uint16_t port = argc > 2 ? atoi(argv[2]) : 5555;
+    unsigned workers = argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
 
-template<typename T>
-T f_smthlse(T a, T b, T c) 
-{
-    return a * b + c;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    FunctionRegistry registry = make_registry();
+    Server server(workers);
+    server.set_admission(1 << 16, AdmissionPolicy::Reject);
+    server.start();
+    NetServer net(registry, server, port);
+    net.start();
+    std::cout << "Listening on port " << port << ", workers: " << server.size() << std::endl;
+
+    int sig;
+    sigwait(&signals, &sig);
+    // Принятые запросы доделываются и уходят клиентам до остановки сети
+    server.drain();
+    net.stop();
+
+    NetStats ns = net.stats();
+    std::cout << "Net: " << ns.responses << " responses, " << ns.writev_calls << " writev calls, "
+              << ns.bytes_sent << " bytes (" << ns.bytes_dropped << " dropped), " << ns.chunks << " buffer chunks" << std::endl;
+    return 0;
 }
 
-void client(int N)
+// server_client remote <host> <port> [N]: N запросов конвейером по окнам
+int remote_main(int argc, char *argv[])
 {
-    std::map<int, int> map;
-
-    while (N > 0)
-    {
-        int arg1 = rand();
-        int arg2 = rand();
-        int arg3 = rand();
+    std::string host = argc > 2 ? argv[2] : "127.0.0.1";
+    uint16_t port = argc > 3 ? atoi(argv[3]) : 5555;
+    int N = argc > 4 ? atoi(argv[4]) : 30000;
+    const int window = 256;
 
-        int id1 = add_task(f_sq<int>, arg1);
-        int id2 = add_task(f_sqrt<int>, arg2);
-        int id3 = add_task(f_sin<int>, arg3);
-        
-        map[id1] = (arg1 * arg1);
-        map[id2] = std::sqrt(arg2);
-        map[id3] = std::sin(arg3);
-        
-        N -= 3;
-    }
+    NetClient client(host, port);
+    uint16_t sq = client.lookup("f_sq");
+    uint16_t sqrt_fn = client.lookup("f_sqrt");
+    uint16_t sin_fn = client.lookup("f_sin");
 
-    
-    for (auto i : map)
+    std::vector<long long> expected(N);
+    double t = now_ns();
+    for (int base = 0; base < N; base += window)
     {
-        int result = request_result<int>(i.first);
-        if (result != map[i.first])
+        int n = std::min(window, N - base);
+        for (int i = base; i < base + n; i++)
         {
-            std::cout << result << " != " << map[i.first] << std::endl;
-            exit(13);
-            //throw std::exception("Wrong result");
+            long long arg = rand();
+            switch (i % 3)
+            {
+            case 0:
+                client.call(i, sq, {arg});
+                expected[i] = arg * arg;
+                break;
+            case 1:
+                client.call(i, sqrt_fn, {arg});
+                expected[i] = std::sqrt(arg);
+                break;
+            default:
+                client.call(i, sin_fn, {arg});
+                expected[i] = std::sin(arg);
+                break;
+            }
+        }
+        client.flush();
+        for (int i = 0; i < n; i++)
+        {
+            NetClient::Response r = client.receive();
+            if (r.status != wire::OK || r.value != expected[r.request_id])
+            {
+                std::cout << r.value << " != " << expected[r.request_id] << std::endl;
+                return 13;
+            }
         }
     }
-    
+    t = (now_ns() - t) * 1e-9;
+    printf("Remote: %d requests OK, %.0f req/s\n", N, N / t);
+    return 0;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "serve")
+        return serve_main(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "remote")
+        return remote_main(argc, argv);
+
+    unsigned workers = std::thread::hardware_concurrency();
+    SchedulerMode mode = SchedulerMode::GlobalQueue;
+    if (argc > 1)
+        workers = atoi(argv[1]);
+    if (argc > 2 && std::string(argv[2]) == "steal")
+        mode = SchedulerMode::WorkStealing;
+    if (argc > 2 && std::string(argv[2]) == "ring")
+        mode = SchedulerMode::LockFreeRing;
+    if (argc > 2 && std::string(argv[2]) == "prio")
+        mode = SchedulerMode::Priority;
+    if (argc > 2 && std::string(argv[2]) == "numa")
+        mode = SchedulerMode::Numa;
+    Affinity pinning = argc > 3 ? parse_affinity(argv[3]) : Affinity::None;
+
     std::cout << "Start\n";
-    Server server;
+    Server server(workers, mode, pinning);
+    server.set_admission(4096);
     server.start();
+    std::cout << "Workers: " << server.size() << ", affinity " << affinity_name(pinning)
+              << ", NUMA nodes " << cpu_topology().node_count() << std::endl;
+    server.set_timing(true);
+    server.dump_stats_every(std::chrono::milliseconds(500));
 
     std::cout << "Running 10000 tasks (Thread 1)" << std::endl;
-    std::thread client1(client, 10000);
+    std::thread client1(client, std::ref(server), 10000);
     std::cout << "Running 10000 tasks (Thread 2)" << std::endl;
-    std::thread client2(client, 10000);
-    std::cout << "Running 10000 tasks (Thread 3)" << std::endl;
-    std::thread client3(client, 10000);
+    std::thread client2(client, std::ref(server), 10000);
+    std::cout << "Running 10000 tasks (Thread 3, batches of 300)" << std::endl;
+    std::thread client3(client_batched, std::ref(server), 10000, 300);
 
-    int task1 = add_task(f_smthlse<int>, 2, 2, 2);
-    int res1 = request_result<int>(task1);
+    auto task1 = server.add_task(f_smthlse<int>, 2, 2, 2);
+    int res1 = task1.get();
     std::cout << res1 << std::endl;
 
+    // Срочные задачи на фоне основной нагрузки
+    for (int i = 0; i < 100; i++)
+    {
+        auto probe = server.add_task(Priority::Interactive, f_smthlse<int>, i, 2, 2);
+        if (probe.get() != i * 2 + 2)
+            exit(13);
+    }
+
+    std::atomic<int> fired{0};
+    for (int i = 0; i < 1000; i++)
+        server.add_detached([&fired] { fired++; });
+
+    auto chained = server.add_task(f_sq<int>, 3)
+        .then([](int x) { return x + 1; })
+        .then(f_sqrt<int>);
+    std::cout << chained.get() << std::endl;
+
+    // Граф: четыре независимых квадрата, затем их сумма
+    std::vector<int> parts(4);
+    TaskGraph graph(server);
+    auto sum = graph.add([&parts] { return parts[0] + parts[1] + parts[2] + parts[3]; });
+    for (int i = 0; i < 4; i++)
+    {
+        TaskId node = graph.add_detached([&parts, i] { parts[i] = f_sq(i + 1); });
+        graph.precede(node, sum.id());
+    }
+    graph.submit();
+    std::cout << sum.get() << std::endl;
+
+    std::vector<CoTask<long long>> coros;
+    for (int i = 0; i < 1000; i++)
+        coros.push_back(co_client(server, 30));
+    long long co_sum = 0;
+    for (auto& c : coros)
+        co_sum += c.get();
+    std::cout << "Coroutines: " << coros.size() << ", sum " << co_sum << std::endl;
+
+    while (fired.load() < 1000)
+        std::this_thread::yield();
+    std::cout << "Detached tasks done: " << fired.load() << std::endl;
+
     client1.join();
     std::cout << "Thread 1 joined" << std::endl;
     client2.join();
     std::cout << "Thread 2 joined" << std::endl;
     client3.join();
     std::cout << "Thread 3 joined" << std::endl;
+
+    // Два независимых пула в одном процессе: свои очереди, таблицы и счётчики
+    {
+        Server left(2, mode);
+        Server right(2, mode);
+        left.start();
+        right.start();
+        std::thread a(client, std::ref(left), 3000);
+        std::thread b(client, std::ref(right), 3000);
+        a.join();
+        b.join();
+        std::cout << "Isolated pools: " << left.stats().tasks << " + "
+                  << right.stats().tasks << " tasks" << std::endl;
+    }
+
+    // Единственный обработчик кольца порождает больше задач, чем кольцо
+    // вмещает: разгрузить его некому, и лишнее уходит в список переполнения
+    {
+        Server ring(1, SchedulerMode::LockFreeRing);
+        ring.start();
+        const int spawned = RING_CAPACITY + 4464;
+        std::atomic<int> done{0};
+        ring.add_task([&ring, &done, spawned]
+        {
+            for (int i = 0; i < spawned; i++)
+                ring.add_detached([&done] { done++; });
+            return 0;
+        }).get();
+        ring.drain();
+        if (done.load() != spawned)
+            exit(13);
+        std::cout << "Ring overflow: " << done.load() << " tasks from one worker" << std::endl;
+    }
     
+    ServerStats stats = server.stats();
     server.stop();
+    stats.print(std::cout);
+
+    for (size_t c = 0; c < PRIORITY_COUNT; c++)
+    {
+        Priority p = static_cast<Priority>(c);
+        LatencySnapshot wait = server.queue_wait(p);
+        if (wait.count == 0)
+            continue;
+        std::cout << "Queue wait (" << priority_name(p) << "): " << wait.count << " tasks, p50 "
+                  << wait.percentile(0.5) / 1000.0 << " us, p99 "
+                  << wait.percentile(0.99) / 1000.0 << " us, max "
+                  << wait.max / 1000.0 << " us" << std::endl;
+    }
+
+    WrapperPool::Stats pool = WrapperPool::stats();
+    std::cout << "Wrapper pool: " << pool.system_allocs << " chunk mallocs ("
+              << pool.bytes_reserved / 1024 << " KiB), "
+              << pool.oversize_allocs << " oversize, "
+              << pool.depot_refills << " refills, "
+              << pool.depot_spills << " spills" << std::endl;
     std::cout << "End\n";
 }
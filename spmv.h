@@ -0,0 +1,237 @@
+// Разреженные форматы для умножения на вектор: CSR и SELL-C-σ. Оба строятся
+// из плотного массива по строкам (нулевые элементы выбрасываются). Работу
+// между потоками делим по числу ненулевых, а не строк: полоса из длинных
+// строк иначе достаётся одному потоку, пока остальные ждут.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#include "mv_kernel.h"
+
+// Номера столбцов 32-битные: вдвое меньше байт на элемент индекса, а
+// столбцов больше 2^32 у плотного прообраза всё равно не бывает
+struct CsrMatrix {
+    size_t m = 0, n = 0;
+    std::vector<size_t> row_ptr; // m + 1 смещений; строка i — [row_ptr[i], row_ptr[i + 1])
+    std::vector<uint32_t> col;
+    std::vector<double> val;
+
+    size_t nnz() const { return val.size(); }
+
+    static CsrMatrix from_dense(const double* a, size_t m, size_t n) {
+        CsrMatrix s;
+        s.m = m;
+        s.n = n;
+        s.row_ptr.assign(m + 1, 0);
+        for (size_t i = 0; i < m; i++) {
+            size_t cnt = 0;
+            for (size_t j = 0; j < n; j++) {
+                cnt += a[i * n + j] != 0.0;
+            }
+            s.row_ptr[i + 1] = s.row_ptr[i] + cnt;
+        }
+        s.col.resize(s.row_ptr[m]);
+        s.val.resize(s.row_ptr[m]);
+        for (size_t i = 0; i < m; i++) {
+            size_t k = s.row_ptr[i];
+            for (size_t j = 0; j < n; j++) {
+                if (a[i * n + j] != 0.0) {
+                    s.col[k] = static_cast<uint32_t>(j);
+                    s.val[k] = a[i * n + j];
+                    k++;
+                }
+            }
+        }
+        return s;
+    }
+};
+
+inline void spmv_csr_rows(const CsrMatrix& s, const double* x, double* y, size_t lb, size_t ub) {
+    for (size_t i = lb; i < ub; i++) {
+        double sum = 0.0;
+        for (size_t k = s.row_ptr[i]; k < s.row_ptr[i + 1]; k++) {
+            sum += s.val[k] * x[s.col[k]];
+        }
+        y[i] = sum;
+    }
+}
+
+// SELL-C-σ: строки внутри окна из σ строк сортируются по убыванию длины,
+// затем режутся на куски по C строк. Кусок дополняется нулями до самой
+// длинной своей строки и лежит по столбцам: элементы j всех C строк рядом,
+// так что одна векторная загрузка берёт по элементу из C строк. Сортировка
+// делает строки куска близкими по длине, и дополнения мало.
+struct SellMatrix {
+    static constexpr size_t C = 8; // ширина вектора AVX-512 в double
+
+    size_t m = 0, n = 0, sigma = 0;
+    std::vector<size_t> chunk_ptr;   // начало куска в col/val; chunks + 1 смещений
+    std::vector<uint32_t> chunk_len; // длина куска (самая длинная строка)
+    std::vector<uint32_t> col;       // у дополнения — столбец 0 и значение 0
+    std::vector<double> val;
+    std::vector<uint32_t> perm;      // строка исходной матрицы по месту после сортировки
+
+    size_t chunks() const { return chunk_len.size(); }
+    size_t stored() const { return val.size(); } // с дополнением
+
+    static SellMatrix from_csr(const CsrMatrix& s, size_t sigma) {
+        SellMatrix e;
+        e.m = s.m;
+        e.n = s.n;
+        e.sigma = std::max(sigma, C);
+        auto len = [&](uint32_t i) { return s.row_ptr[i + 1] - s.row_ptr[i]; };
+
+        e.perm.resize(s.m);
+        std::iota(e.perm.begin(), e.perm.end(), 0u);
+        for (size_t w = 0; w < s.m; w += e.sigma) {
+            auto end = e.perm.begin() + std::min(s.m, w + e.sigma);
+            std::stable_sort(e.perm.begin() + w, end,
+                             [&](uint32_t x, uint32_t y) { return len(x) > len(y); });
+        }
+
+        size_t nchunks = (s.m + C - 1) / C;
+        e.chunk_ptr.assign(nchunks + 1, 0);
+        e.chunk_len.resize(nchunks);
+        for (size_t ch = 0; ch < nchunks; ch++) {
+            size_t longest = 0;
+            for (size_t r = ch * C; r < std::min(s.m, ch * C + C); r++) {
+                longest = std::max(longest, len(e.perm[r]));
+            }
+            e.chunk_len[ch] = static_cast<uint32_t>(longest);
+            e.chunk_ptr[ch + 1] = e.chunk_ptr[ch] + longest * C;
+        }
+
+        e.col.assign(e.chunk_ptr[nchunks], 0);
+        e.val.assign(e.chunk_ptr[nchunks], 0.0);
+        for (size_t r = 0; r < s.m; r++) {
+            size_t ch = r / C, lane = r % C;
+            uint32_t row = e.perm[r];
+            size_t k0 = s.row_ptr[row];
+            for (size_t j = 0; j < len(row); j++) {
+                e.col[e.chunk_ptr[ch] + j * C + lane] = s.col[k0 + j];
+                e.val[e.chunk_ptr[ch] + j * C + lane] = s.val[k0 + j];
+            }
+        }
+        return e;
+    }
+};
+
+using SellChunksFn = void (*)(const SellMatrix& e, const double* x, double* y,
+                              size_t lb, size_t ub);
+
+// Куски [lb, ub); результат пишется по исходным номерам строк
+inline void spmv_sell_scalar(const SellMatrix& e, const double* x, double* y,
+                             size_t lb, size_t ub) {
+    constexpr size_t C = SellMatrix::C;
+    for (size_t ch = lb; ch < ub; ch++) {
+        const double* v = e.val.data() + e.chunk_ptr[ch];
+        const uint32_t* cl = e.col.data() + e.chunk_ptr[ch];
+        double sum[C] = {};
+        for (size_t j = 0; j < e.chunk_len[ch]; j++) {
+            for (size_t r = 0; r < C; r++) {
+                sum[r] += v[j * C + r] * x[cl[j * C + r]];
+            }
+        }
+        for (size_t r = 0; r < C && ch * C + r < e.m; r++) {
+            y[e.perm[ch * C + r]] = sum[r];
+        }
+    }
+}
+
+#ifdef MV_X86
+
+// Элементы x собираются gather по 8 (AVX-512) или 2 x 4 (AVX2) индексам.
+// Gather без маски в GCC 12 берёт исходное значение из _mm*_undefined_pd(),
+// и -Wmaybe-uninitialized срабатывает на каждой подстановке; поэтому
+// маскированный вариант с полной маской и нулём.
+MV_AVX2_TARGET
+inline void spmv_sell_avx2(const SellMatrix& e, const double* x, double* y,
+                           size_t lb, size_t ub) {
+    constexpr size_t C = SellMatrix::C;
+    for (size_t ch = lb; ch < ub; ch++) {
+        const double* v = e.val.data() + e.chunk_ptr[ch];
+        const uint32_t* cl = e.col.data() + e.chunk_ptr[ch];
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        __m256d s0 = zero;
+        __m256d s1 = zero;
+        for (size_t j = 0; j < e.chunk_len[ch]; j++) {
+            __m128i i0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cl + j * C));
+            __m128i i1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cl + j * C + 4));
+            __m256d x0 = _mm256_mask_i32gather_pd(zero, x, i0, all, 8);
+            __m256d x1 = _mm256_mask_i32gather_pd(zero, x, i1, all, 8);
+            s0 = _mm256_fmadd_pd(_mm256_loadu_pd(v + j * C), x0, s0);
+            s1 = _mm256_fmadd_pd(_mm256_loadu_pd(v + j * C + 4), x1, s1);
+        }
+        alignas(32) double sum[C];
+        _mm256_store_pd(sum, s0);
+        _mm256_store_pd(sum + 4, s1);
+        for (size_t r = 0; r < C && ch * C + r < e.m; r++) {
+            y[e.perm[ch * C + r]] = sum[r];
+        }
+    }
+}
+
+MV_AVX512_TARGET
+inline void spmv_sell_avx512(const SellMatrix& e, const double* x, double* y,
+                             size_t lb, size_t ub) {
+    constexpr size_t C = SellMatrix::C;
+    for (size_t ch = lb; ch < ub; ch++) {
+        const double* v = e.val.data() + e.chunk_ptr[ch];
+        const uint32_t* cl = e.col.data() + e.chunk_ptr[ch];
+        __m512d s = _mm512_setzero_pd();
+        for (size_t j = 0; j < e.chunk_len[ch]; j++) {
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cl + j * C));
+            __m512d xv = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, idx, x, 8);
+            s = _mm512_fmadd_pd(_mm512_loadu_pd(v + j * C), xv, s);
+        }
+        alignas(64) double sum[C];
+        _mm512_store_pd(sum, s);
+        for (size_t r = 0; r < C && ch * C + r < e.m; r++) {
+            y[e.perm[ch * C + r]] = sum[r];
+        }
+    }
+}
+
+#endif // MV_X86
+
+// У NEON нет gather: там скалярное ядро, его цикл по C компилятор
+// векторизует сам
+inline SellChunksFn sell_kernel_fn(MvKernel k) {
+    switch (resolve_kernel(k)) {
+#ifdef MV_X86
+    case MvKernel::Avx2: return spmv_sell_avx2;
+    case MvKernel::Avx512: return spmv_sell_avx512;
+#endif
+    default: return spmv_sell_scalar;
+    }
+}
+
+// Границы parts частей по префиксным суммам весов prefix (count + 1
+// значений, как row_ptr или chunk_ptr): часть p — [bounds[p], bounds[p + 1]),
+// весу в каждой около total / parts. Одна очень тяжёлая строка не делится,
+// соседние части тогда выходят пустыми.
+inline std::vector<size_t> split_by_weight(const std::vector<size_t>& prefix, size_t parts) {
+    size_t count = prefix.size() - 1;
+    size_t total = prefix.back();
+    std::vector<size_t> bounds(parts + 1, count);
+    bounds[0] = 0;
+    for (size_t p = 1; p < parts; p++) {
+        size_t target = total / parts * p + total % parts * p / parts;
+        size_t at = std::lower_bound(prefix.begin(), prefix.end(), target) - prefix.begin();
+        bounds[p] = std::clamp(at, bounds[p - 1], count);
+    }
+    return bounds;
+}
+
+// Деление поровну по числу строк (кусков) — для сравнения с делением по весу
+inline std::vector<size_t> split_even(size_t count, size_t parts) {
+    std::vector<size_t> bounds(parts + 1);
+    for (size_t p = 0; p <= parts; p++) {
+        bounds[p] = count / parts * p + std::min(p, count % parts);
+    }
+    return bounds;
+}
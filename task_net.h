@@ -0,0 +1,879 @@
+// Сетевой фронтенд сервера задач: TCP + epoll, один поток на все соединения.
+// Удалённые запросы вызывают функции из реестра по номеру и попадают в ту же
+// очередь задач, что и локальные add_task. Готовые ответы копятся по
+// соединениям и уходят пачками через writev.
+#pragma once
+
+#include "task_server.h"
+#include <array>
+#include <string>
+#include <cstring>
+#include <system_error>
+#include <unordered_map>
+#include <deque>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Формат кадров (все поля в порядке байт хоста, little-endian):
+//   запрос: u32 длина остатка | u32 id запроса | u16 функция | u8 argc | u8 0 | argc * i64
+//   ответ:  u32 длина остатка | u32 id запроса | u8 статус | 3 байта 0 | i64 значение
+// Функция LOOKUP_FUNCTION с argc = 0 ищет функцию по имени (имя — остаток
+// кадра), ответ содержит её номер. Запросы одного соединения можно слать
+// подряд, не дожидаясь ответов; ответы приходят в порядке завершения.
+namespace wire {
+
+constexpr uint16_t LOOKUP_FUNCTION = 0xFFFF;
+constexpr size_t MAX_ARGS = 4;
+constexpr size_t REQUEST_HEADER = 12;
+constexpr size_t RESPONSE_SIZE = 20;
+constexpr size_t MAX_FRAME = 4096;
+
+enum Status : uint8_t {
+    OK = 0,
+    UNKNOWN_FUNCTION = 1,
+    BAD_ARGUMENTS = 2,
+    OVERLOADED = 3 // очередь сервера заполнена, запрос не выполнялся
+};
+
+template<typename T>
+T load(const char* p) {
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+template<typename T>
+void store(char* p, T v) {
+    std::memcpy(p, &v, sizeof(T));
+}
+
+inline void encode_response(char* p, uint32_t request_id, uint8_t status, int64_t value) {
+    store<uint32_t>(p, RESPONSE_SIZE - 4);
+    store<uint32_t>(p + 4, request_id);
+    store<uint32_t>(p + 8, status);
+    store<int64_t>(p + 12, value);
+}
+
+} // namespace wire
+
+inline void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::system_error(errno, std::generic_category(), "fcntl");
+    }
+}
+
+// Реестр функций, доступных удалённым клиентам. Аргументы и результат
+// передаются как i64. Регистрировать функции нужно до запуска NetServer.
+class FunctionRegistry {
+public:
+    struct Entry {
+        std::string name;
+        size_t arity;
+        std::function<int64_t(const int64_t*)> call;
+    };
+
+    template<typename R, typename... A>
+    uint16_t add(const std::string& name, R (*f)(A...)) {
+        static_assert(sizeof...(A) <= wire::MAX_ARGS, "Too many arguments for remote call");
+        Entry e;
+        e.name = name;
+        e.arity = sizeof...(A);
+        e.call = [f](const int64_t* args) {
+            return invoke(f, args, std::index_sequence_for<A...>{});
+        };
+        entries.push_back(std::move(e));
+        return static_cast<uint16_t>(entries.size() - 1);
+    }
+
+    const Entry* find(uint16_t index) const {
+        return index < entries.size() ? &entries[index] : nullptr;
+    }
+
+    int find(const std::string& name) const {
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].name == name) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+private:
+    std::vector<Entry> entries;
+
+    template<typename R, typename... A, size_t... I>
+    static int64_t invoke(R (*f)(A...), const int64_t* args, std::index_sequence<I...>) {
+        return static_cast<int64_t>(f(static_cast<A>(args[I])...));
+    }
+};
+
+// Кусок выходного буфера. Ответы кодируются прямо в него и уходят в writev
+// без промежуточных копий; куски заранее выделены и переиспользуются.
+struct OutChunk {
+    static constexpr size_t SIZE = 16 * 1024;
+    size_t used = 0;
+    char data[SIZE];
+};
+
+class ChunkPool {
+public:
+    explicit ChunkPool(size_t prealloc) {
+        for (size_t i = 0; i < prealloc; i++) {
+            all.push_back(std::make_unique<OutChunk>());
+            free_chunks.push_back(all.back().get());
+        }
+    }
+
+    OutChunk* get() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (free_chunks.empty()) {
+            all.push_back(std::make_unique<OutChunk>());
+            return all.back().get();
+        }
+        OutChunk* c = free_chunks.back();
+        free_chunks.pop_back();
+        return c;
+    }
+
+    void put(OutChunk* c) {
+        c->used = 0;
+        std::lock_guard<std::mutex> lock(mtx);
+        free_chunks.push_back(c);
+    }
+
+    size_t allocated() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return all.size();
+    }
+
+private:
+    std::mutex mtx;
+    std::vector<OutChunk*> free_chunks;
+    std::vector<std::unique_ptr<OutChunk>> all;
+};
+
+// Соединение. Входной буфер, сокет и очередь отправки трогает только поток
+// epoll; куски out пополняют обработчики задач под out_mtx.
+struct Connection {
+    int fd;
+    std::vector<char> in;
+    size_t in_off = 0;
+
+    std::mutex out_mtx;
+    std::vector<OutChunk*> out;
+    size_t pending_bytes = 0;      // накоплено в out и ещё не отдано на отправку
+    uint64_t first_pending_ns = 0; // когда в out лёг первый из этих ответов
+    bool urgent = false;           // порог по объёму уже сработал
+    bool scheduled = false;        // соединение стоит в списке NetServer::pending
+
+    std::deque<OutChunk*> sending;
+    size_t send_off = 0;           // отправленная часть первого куска sending
+    bool want_write = false;
+
+    std::atomic<bool> closed{false};
+
+    explicit Connection(int f) : fd(f) {}
+};
+
+class NetServer;
+
+// Задача удалённого вызова: выполняется обработчиком, ответ отдаёт NetServer
+struct RemoteCall {
+    NetServer* server;
+    std::shared_ptr<Connection> conn;
+    const FunctionRegistry::Entry* fn;
+    uint32_t request_id;
+    std::array<int64_t, wire::MAX_ARGS> args;
+
+    void operator()() const;
+    void on_cancel() const;
+};
+
+// Когда сбрасывать накопленные ответы соединения: по объёму или по времени
+// с момента первого неотправленного ответа
+struct FlushPolicy {
+    size_t bytes = 8 * 1024;
+    std::chrono::microseconds interval{200};
+};
+
+struct NetStats {
+    uint64_t responses = 0;
+    uint64_t writev_calls = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_dropped = 0; // не ушли за SHUTDOWN_FLUSH при остановке
+    size_t chunks = 0;
+};
+
+class NetServer {
+public:
+    static constexpr size_t PREALLOC_CHUNKS = 64;
+    // Сколько stop() досылает накопленные ответы медленным клиентам
+    static constexpr std::chrono::milliseconds SHUTDOWN_FLUSH{1000};
+    // На сколько снимается listen_fd, когда accept упёрся в пределы
+    static constexpr std::chrono::milliseconds ACCEPT_BACKOFF{100};
+
+    // Запросы исполняются на пуле tasks; он должен пережить NetServer
+    NetServer(const FunctionRegistry& reg, ServerCore& tasks, uint16_t port,
+              FlushPolicy flush_policy = {})
+        : registry(reg), task_server(tasks), policy(flush_policy), chunks(PREALLOC_CHUNKS) {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "socket");
+        }
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            listen(listen_fd, SOMAXCONN) < 0) {
+            int err = errno;
+            close(listen_fd);
+            throw std::system_error(err, std::generic_category(), "bind/listen");
+        }
+        set_nonblocking(listen_fd);
+
+        epoll_fd = epoll_create1(0);
+        wake_fd = eventfd(0, EFD_NONBLOCK);
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        accept_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (epoll_fd < 0 || wake_fd < 0 || timer_fd < 0 || accept_timer_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "epoll/eventfd/timerfd");
+        }
+        watch(listen_fd, EPOLLIN);
+        watch(wake_fd, EPOLLIN);
+        watch(timer_fd, EPOLLIN);
+        watch(accept_timer_fd, EPOLLIN);
+    }
+
+    NetServer(const NetServer&) = delete;
+    NetServer& operator=(const NetServer&) = delete;
+
+    ~NetServer() {
+        stop();
+        for (auto& [fd, conn] : conns) {
+            conn->closed.store(true);
+            close(fd);
+        }
+        close(accept_timer_fd);
+        close(timer_fd);
+        close(wake_fd);
+        close(epoll_fd);
+        close(listen_fd);
+    }
+
+    void start() {
+        loop_thread = std::jthread([this](std::stop_token stoken) { loop(stoken); });
+    }
+
+    // Задачи, ещё стоящие в очереди, могут завершиться после stop(): сервер
+    // задач нужно остановить раньше, чем удалять NetServer
+    void stop() {
+        if (loop_thread.joinable()) {
+            loop_thread.request_stop();
+            wake();
+            loop_thread.join();
+        }
+    }
+
+    NetStats stats() {
+        NetStats s;
+        s.responses = responses.load(std::memory_order_relaxed);
+        s.writev_calls = writev_calls.load(std::memory_order_relaxed);
+        s.bytes_sent = bytes_sent.load(std::memory_order_relaxed);
+        s.bytes_dropped = bytes_dropped.load(std::memory_order_relaxed);
+        s.chunks = chunks.allocated();
+        return s;
+    }
+
+    // Вызывается обработчиком: кодирует ответ прямо в кусок соединения.
+    // Поток epoll будим только по первому ответу пачки (чтобы он завёл
+    // таймер) и при достижении порога по объёму.
+    void complete(const std::shared_ptr<Connection>& conn, uint32_t request_id,
+                  uint8_t status, int64_t value) {
+        bool schedule = false;
+        bool urgent = false;
+        {
+            std::lock_guard<std::mutex> lock(conn->out_mtx);
+            if (conn->closed.load(std::memory_order_relaxed)) {
+                return;
+            }
+            if (conn->out.empty() || conn->out.back()->used + wire::RESPONSE_SIZE > OutChunk::SIZE) {
+                conn->out.push_back(chunks.get());
+            }
+            OutChunk* c = conn->out.back();
+            wire::encode_response(c->data + c->used, request_id, status, value);
+            c->used += wire::RESPONSE_SIZE;
+
+            if (conn->pending_bytes == 0) {
+                conn->first_pending_ns = now_ns();
+            }
+            conn->pending_bytes += wire::RESPONSE_SIZE;
+            if (!conn->urgent && conn->pending_bytes >= policy.bytes) {
+                conn->urgent = urgent = true;
+            }
+            if (!conn->scheduled) {
+                conn->scheduled = schedule = true;
+            }
+        }
+
+        bool need_wake = urgent;
+        if (schedule) {
+            std::lock_guard<std::mutex> lock(pending_mtx);
+            need_wake |= pending.empty();
+            pending.push_back(conn);
+        }
+        if (need_wake) {
+            wake();
+        }
+    }
+
+private:
+    const FunctionRegistry& registry;
+    ServerCore& task_server;
+    FlushPolicy policy;
+    ChunkPool chunks;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int timer_fd = -1;
+    int accept_timer_fd = -1;
+    std::unordered_map<int, std::shared_ptr<Connection>> conns;
+    // Снятые с epoll, но ещё не закрытые дескрипторы: закрываются в конце
+    // пачки событий, чтобы номер не переиспользовался посреди неё
+    std::vector<int> dropped_fds;
+    // Соединения с неотправленными ответами
+    std::mutex pending_mtx;
+    std::vector<std::shared_ptr<Connection>> pending;
+    std::jthread loop_thread;
+
+    std::atomic<uint64_t> responses{0};
+    std::atomic<uint64_t> writev_calls{0};
+    std::atomic<uint64_t> bytes_sent{0};
+    std::atomic<uint64_t> bytes_dropped{0};
+
+    bool try_watch(int fd, uint32_t events) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    void watch(int fd, uint32_t events) {
+        if (!try_watch(fd, events)) {
+            throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+        }
+    }
+
+    void rearm(Connection& conn, bool writable) {
+        if (conn.want_write == writable) {
+            return;
+        }
+        conn.want_write = writable;
+        epoll_event ev{};
+        ev.events = uint32_t(EPOLLIN) | (writable ? uint32_t(EPOLLOUT) : 0u);
+        ev.data.fd = conn.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t r = write(wake_fd, &one, sizeof(one));
+        (void)r;
+    }
+
+    void drain_fd(int fd) {
+        uint64_t cnt;
+        ssize_t r = read(fd, &cnt, sizeof(cnt));
+        (void)r;
+    }
+
+    void loop(std::stop_token stoken) {
+        epoll_event events[64];
+        while (!stoken.stop_requested()) {
+            int n = epoll_wait(epoll_fd, events, 64, -1);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "epoll_wait");
+            }
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd) {
+                    accept_all();
+                } else if (fd == wake_fd || fd == timer_fd) {
+                    drain_fd(fd);
+                } else if (fd == accept_timer_fd) {
+                    drain_fd(fd);
+                    set_accepting(true);
+                } else {
+                    auto it = conns.find(fd);
+                    if (it == conns.end()) {
+                        continue;
+                    }
+                    std::shared_ptr<Connection> conn = it->second;
+                    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        drop(*conn);
+                        continue;
+                    }
+                    if (events[i].events & EPOLLOUT) {
+                        flush(*conn);
+                    }
+                    if ((events[i].events & EPOLLIN) && !conn->closed.load()) {
+                        read_requests(*conn, conn);
+                    }
+                }
+            }
+            service_pending(false);
+            close_dropped();
+        }
+        // Накопленное к остановке уходит сразу, не дожидаясь порогов
+        service_pending(true);
+        flush_on_shutdown();
+        close_dropped();
+    }
+
+    // После выхода из цикла EPOLLOUT никто не обслуживает, а flush() на
+    // EAGAIN лишь взводит его. Досылаем сами, ожидая сокеты через poll, но
+    // не дольше SHUTDOWN_FLUSH на всех; не ушедшее считается в bytes_dropped,
+    // куски возвращаются в пул.
+    void flush_on_shutdown() {
+        auto deadline = std::chrono::steady_clock::now() + SHUTDOWN_FLUSH;
+        std::vector<std::shared_ptr<Connection>> waiting;
+        std::vector<pollfd> fds;
+        for (;;) {
+            waiting.clear();
+            fds.clear();
+            for (auto& [fd, conn] : conns) {
+                if (!conn->sending.empty()) {
+                    waiting.push_back(conn);
+                    fds.push_back(pollfd{fd, POLLOUT, 0});
+                }
+            }
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (waiting.empty() || left.count() <= 0) {
+                break;
+            }
+            int n = poll(fds.data(), fds.size(), static_cast<int>(left.count()));
+            if (n < 0 && errno != EINTR) {
+                break;
+            }
+            for (size_t i = 0; i < fds.size() && n > 0; i++) {
+                if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                    count_dropped(*waiting[i]);
+                    drop(*waiting[i]);
+                } else if (fds[i].revents & POLLOUT) {
+                    flush(*waiting[i]);
+                }
+            }
+        }
+        for (auto& conn : waiting) {
+            count_dropped(*conn);
+            for (OutChunk* c : conn->sending) {
+                chunks.put(c);
+            }
+            conn->sending.clear();
+            conn->send_off = 0;
+        }
+    }
+
+    void count_dropped(const Connection& conn) {
+        uint64_t bytes = 0;
+        for (OutChunk* c : conn.sending) {
+            bytes += c->used;
+        }
+        bytes_dropped.fetch_add(bytes - conn.send_off, std::memory_order_relaxed);
+    }
+
+    // Отправляет соединения, у которых сработал порог по объёму или по
+    // времени (или все при force); остальные ждут, а таймер ставится на
+    // ближайший срок
+    void service_pending(bool force) {
+        std::vector<std::shared_ptr<Connection>> list;
+        {
+            std::lock_guard<std::mutex> lock(pending_mtx);
+            list.swap(pending);
+        }
+        if (list.empty()) {
+            return;
+        }
+
+        uint64_t now = now_ns();
+        uint64_t interval = std::chrono::duration_cast<std::chrono::nanoseconds>(policy.interval).count();
+        uint64_t next_deadline = UINT64_MAX;
+        std::vector<std::shared_ptr<Connection>> keep;
+
+        for (auto& conn : list) {
+            bool due = false;
+            {
+                std::lock_guard<std::mutex> lock(conn->out_mtx);
+                if (conn->closed.load()) {
+                    continue;
+                }
+                uint64_t deadline = conn->first_pending_ns + interval;
+                if (force || conn->urgent || now >= deadline) {
+                    due = true;
+                    responses.fetch_add(conn->pending_bytes / wire::RESPONSE_SIZE, std::memory_order_relaxed);
+                    conn->sending.insert(conn->sending.end(), conn->out.begin(), conn->out.end());
+                    conn->out.clear();
+                    conn->pending_bytes = 0;
+                    conn->urgent = false;
+                    conn->scheduled = false;
+                } else {
+                    next_deadline = std::min(next_deadline, deadline);
+                }
+            }
+            if (due) {
+                flush(*conn);
+            } else {
+                keep.push_back(conn);
+            }
+        }
+
+        if (!keep.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(pending_mtx);
+                pending.insert(pending.end(), keep.begin(), keep.end());
+            }
+            uint64_t delay = next_deadline > now ? next_deadline - now : 1;
+            itimerspec ts{};
+            ts.it_value.tv_sec = delay / 1000000000;
+            ts.it_value.tv_nsec = delay % 1000000000;
+            timerfd_settime(timer_fd, 0, &ts, nullptr);
+        }
+    }
+
+    // Цикл живёт в jthread, и исключение отсюда уронило бы процесс, поэтому
+    // не бросаем: соединение, которое не удалось завести, просто закрываем.
+    // listen_fd level-triggered, и при нехватке дескрипторов или памяти
+    // (EMFILE, ENFILE, ENOBUFS, ENOMEM) epoll сразу вернул бы его снова;
+    // вместо этого снимаем его на ACCEPT_BACKOFF, клиенты ждут в очереди
+    // listen.
+    void accept_all() {
+        for (;;) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    pause_accept();
+                }
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (!try_watch(fd, EPOLLIN)) {
+                close(fd);
+                pause_accept();
+                return;
+            }
+            conns[fd] = std::make_shared<Connection>(fd);
+        }
+    }
+
+    void pause_accept() {
+        set_accepting(false);
+        itimerspec ts{};
+        ts.it_value.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(ACCEPT_BACKOFF).count();
+        timerfd_settime(accept_timer_fd, 0, &ts, nullptr);
+    }
+
+    void set_accepting(bool on) {
+        epoll_event ev{};
+        ev.events = on ? uint32_t(EPOLLIN) : 0u;
+        ev.data.fd = listen_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &ev);
+    }
+
+    void drop(Connection& conn) {
+        {
+            std::lock_guard<std::mutex> lock(conn.out_mtx);
+            conn.closed.store(true);
+            for (OutChunk* c : conn.out) {
+                chunks.put(c);
+            }
+            conn.out.clear();
+        }
+        for (OutChunk* c : conn.sending) {
+            chunks.put(c);
+        }
+        conn.sending.clear();
+        // Остаток пачки ещё может нести события этого fd. Пока он не закрыт,
+        // accept не выдаст тот же номер новому соединению, и такие события
+        // не найдут его в conns
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        dropped_fds.push_back(conn.fd);
+        conns.erase(conn.fd);
+    }
+
+    void close_dropped() {
+        for (int fd : dropped_fds) {
+            close(fd);
+        }
+        dropped_fds.clear();
+    }
+
+    void read_requests(Connection& conn, const std::shared_ptr<Connection>& self) {
+        char buf[64 * 1024];
+        ssize_t r = read(conn.fd, buf, sizeof(buf));
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+            drop(conn);
+            return;
+        }
+        if (r < 0) {
+            return;
+        }
+        conn.in.insert(conn.in.end(), buf, buf + r);
+
+        while (conn.in.size() - conn.in_off >= 4) {
+            const char* p = conn.in.data() + conn.in_off;
+            uint32_t len = wire::load<uint32_t>(p);
+            if (len + 4 > wire::MAX_FRAME || len + 4 < wire::REQUEST_HEADER) {
+                drop(conn);
+                return;
+            }
+            if (conn.in.size() - conn.in_off < len + 4) {
+                break;
+            }
+            handle_frame(self, p, len + 4);
+            conn.in_off += len + 4;
+        }
+        if (conn.in_off == conn.in.size()) {
+            conn.in.clear();
+            conn.in_off = 0;
+        } else if (conn.in_off > conn.in.size() / 2) {
+            conn.in.erase(conn.in.begin(), conn.in.begin() + conn.in_off);
+            conn.in_off = 0;
+        }
+    }
+
+    void handle_frame(const std::shared_ptr<Connection>& conn, const char* p, size_t size) {
+        uint32_t request_id = wire::load<uint32_t>(p + 4);
+        uint16_t function = wire::load<uint16_t>(p + 8);
+        uint8_t argc = static_cast<uint8_t>(p[10]);
+
+        if (function == wire::LOOKUP_FUNCTION) {
+            std::string name(p + wire::REQUEST_HEADER, size - wire::REQUEST_HEADER);
+            int index = registry.find(name);
+            complete(conn, request_id, index < 0 ? wire::UNKNOWN_FUNCTION : wire::OK, index);
+            return;
+        }
+
+        const FunctionRegistry::Entry* fn = registry.find(function);
+        if (!fn) {
+            complete(conn, request_id, wire::UNKNOWN_FUNCTION, 0);
+            return;
+        }
+        if (argc != fn->arity || size != wire::REQUEST_HEADER + argc * sizeof(int64_t)) {
+            complete(conn, request_id, wire::BAD_ARGUMENTS, 0);
+            return;
+        }
+
+        RemoteCall call{this, conn, fn, request_id, {}};
+        for (size_t i = 0; i < argc; i++) {
+            call.args[i] = wire::load<int64_t>(p + wire::REQUEST_HEADER + i * sizeof(int64_t));
+        }
+        // Поток epoll не блокируется на заполненной очереди
+        if (!task_server.try_add_detached(std::move(call))) {
+            complete(conn, request_id, wire::OVERLOADED, 0);
+        }
+    }
+
+    // Отправляет очередь кусков одним writev на до IOV_BATCH кусков;
+    // полностью ушедшие куски возвращаются в пул
+    void flush(Connection& conn) {
+        constexpr size_t IOV_BATCH = 64;
+        while (!conn.sending.empty()) {
+            iovec iov[IOV_BATCH];
+            size_t cnt = 0;
+            for (OutChunk* c : conn.sending) {
+                if (cnt == IOV_BATCH) {
+                    break;
+                }
+                size_t off = cnt == 0 ? conn.send_off : 0;
+                iov[cnt].iov_base = c->data + off;
+                iov[cnt].iov_len = c->used - off;
+                cnt++;
+            }
+
+            ssize_t w = writev(conn.fd, iov, static_cast<int>(cnt));
+            writev_calls.fetch_add(1, std::memory_order_relaxed);
+            if (w < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    rearm(conn, true);
+                } else {
+                    drop(conn);
+                }
+                return;
+            }
+            bytes_sent.fetch_add(w, std::memory_order_relaxed);
+
+            size_t left = static_cast<size_t>(w);
+            while (left > 0) {
+                OutChunk* c = conn.sending.front();
+                size_t rest = c->used - conn.send_off;
+                if (left < rest) {
+                    conn.send_off += left;
+                    break;
+                }
+                left -= rest;
+                conn.send_off = 0;
+                conn.sending.pop_front();
+                chunks.put(c);
+            }
+        }
+        rearm(conn, false);
+    }
+};
+
+inline void RemoteCall::operator()() const {
+    server->complete(conn, request_id, wire::OK, fn->call(args.data()));
+}
+
+inline void RemoteCall::on_cancel() const {
+    server->complete(conn, request_id, wire::OVERLOADED, 0);
+}
+
+// Блокирующий клиент протокола: запросы копятся в буфере и уходят одним
+// send по flush(), ответы читаются по одному
+class NetClient {
+public:
+    struct Response {
+        uint32_t request_id;
+        uint8_t status;
+        int64_t value;
+    };
+
+    NetClient(const std::string& host, uint16_t port) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        int rc = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res);
+        if (rc != 0) {
+            throw std::runtime_error(std::string("getaddrinfo: ") + gai_strerror(rc));
+        }
+        for (addrinfo* a = res; a; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+                break;
+            }
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "connect");
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    NetClient(const NetClient&) = delete;
+    NetClient& operator=(const NetClient&) = delete;
+    ~NetClient() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    uint16_t lookup(const std::string& name) {
+        size_t off = begin_frame(0, wire::LOOKUP_FUNCTION, 0);
+        out.insert(out.end(), name.begin(), name.end());
+        end_frame(off);
+        flush();
+        Response r = receive();
+        if (r.status != wire::OK) {
+            throw std::runtime_error("Unknown remote function: " + name);
+        }
+        return static_cast<uint16_t>(r.value);
+    }
+
+    void call(uint32_t request_id, uint16_t function, std::initializer_list<int64_t> args) {
+        size_t off = begin_frame(request_id, function, static_cast<uint8_t>(args.size()));
+        for (int64_t a : args) {
+            size_t pos = out.size();
+            out.resize(pos + sizeof(int64_t));
+            wire::store<int64_t>(out.data() + pos, a);
+        }
+        end_frame(off);
+    }
+
+    void flush() {
+        size_t sent = 0;
+        while (sent < out.size()) {
+            ssize_t w = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "send");
+            }
+            sent += w;
+        }
+        out.clear();
+    }
+
+    Response receive() {
+        while (in.size() - in_off < wire::RESPONSE_SIZE) {
+            if (in_off > 0) {
+                in.erase(in.begin(), in.begin() + in_off);
+                in_off = 0;
+            }
+            char buf[64 * 1024];
+            ssize_t r = read(fd, buf, sizeof(buf));
+            if (r <= 0) {
+                if (r < 0 && errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Connection closed by server");
+            }
+            in.insert(in.end(), buf, buf + r);
+        }
+        const char* p = in.data() + in_off;
+        Response res{wire::load<uint32_t>(p + 4), static_cast<uint8_t>(p[8]),
+                     wire::load<int64_t>(p + 12)};
+        in_off += wire::RESPONSE_SIZE;
+        return res;
+    }
+
+private:
+    int fd = -1;
+    std::vector<char> out;
+    std::vector<char> in;
+    size_t in_off = 0;
+
+    size_t begin_frame(uint32_t request_id, uint16_t function, uint8_t argc) {
+        size_t off = out.size();
+        out.resize(off + wire::REQUEST_HEADER);
+        char* p = out.data() + off;
+        wire::store<uint32_t>(p + 4, request_id);
+        wire::store<uint16_t>(p + 8, function);
+        p[10] = static_cast<char>(argc);
+        p[11] = 0;
+        return off;
+    }
+
+    void end_frame(size_t off) {
+        wire::store<uint32_t>(out.data() + off, static_cast<uint32_t>(out.size() - off - 4));
+    }
+};
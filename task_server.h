@@ -0,0 +1,2511 @@
+// Сервер задач: пул обработчиков, очереди, таблица задач и API отправки.
+// Подключается из server_client.cpp, server_bench.cpp и других программ.
+#pragma once
+
+#include <iostream>
+#include <queue>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cassert>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <variant>
+#include <type_traits>
+#include <bit>
+#include <span>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+#include <system_error>
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <new>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <atomic>
+#include <tuple>
+#include <stop_token>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+#include "affinity.h"
+
+// Forward declaration
+class TaskWrapperBase;
+
+// Режим планировщика задач
+enum class SchedulerMode {
+    GlobalQueue,  // одна общая очередь под мьютексом
+    WorkStealing, // собственный дек у каждого обработчика + воровство задач
+    LockFreeRing, // ограниченное lock-free кольцо MPMC
+    Priority,     // очереди по классам приоритета
+    Numa          // очередь на каждый узел NUMA, чужие узлы — только когда у своего пусто
+};
+
+// Ёмкость кольца по умолчанию (округляется до степени двойки)
+constexpr size_t RING_CAPACITY = 1 << 16;
+
+// Идентификатор задачи: индекс слота в TaskTable + поколение слота
+using TaskId = uint32_t;
+// Зарезервированные значения, TaskTable их никогда не выдаёт
+constexpr TaskId NO_TASK = UINT32_MAX;
+constexpr TaskId CLOSED_TASK = UINT32_MAX - 1;
+
+// Классы приоритета задач, от самого срочного к фоновому
+enum class Priority : uint8_t {
+    Interactive,
+    Normal,
+    Bulk
+};
+constexpr size_t PRIORITY_COUNT = 3;
+
+inline const char* priority_name(Priority p) {
+    switch (p) {
+    case Priority::Interactive: return "interactive";
+    case Priority::Normal: return "normal";
+    default: return "bulk";
+    }
+}
+
+// Что делать с новой задачей, когда в очереди уже capacity задач
+enum class AdmissionPolicy {
+    Block,  // отправитель ждёт, пока обработчики разберут очередь
+    Reject, // сразу отказ: TaskRejected или пустой optional у try_add_task
+    Shed    // вытеснить самую новую задачу младшего класса, иначе отказ
+};
+
+// Задачу не приняли: очередь заполнена (resource_unavailable_try_again)
+// или сервер останавливается (operation_not_permitted)
+class TaskRejected : public std::system_error {
+public:
+    explicit TaskRejected(std::errc code = std::errc::resource_unavailable_try_again)
+        : std::system_error(std::make_error_code(code),
+                            code == std::errc::resource_unavailable_try_again
+                                ? "Task queue is full" : "Task server is not accepting tasks") {}
+};
+
+// Задача завершилась без выполнения (вытеснена или отменена)
+class TaskCancelled : public std::system_error {
+public:
+    TaskCancelled()
+        : std::system_error(std::make_error_code(std::errc::operation_canceled),
+                            "Task cancelled") {}
+};
+
+inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Снимок гистограммы задержек: корзины можно складывать и считать по ним
+// перцентили
+struct LatencySnapshot {
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    void merge(const LatencySnapshot& other);
+    uint64_t percentile(double q) const;
+    double mean() const { return count ? double(sum) / count : 0.0; }
+};
+
+// Логарифмически-линейная гистограмма (в духе HDR): 2^SUB_BITS корзин на
+// каждую октаву, относительная ошибка не больше 1/2^SUB_BITS. Пишет один
+// поток (или потоки под общим замком), читать можно в любой момент.
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr unsigned SUB_COUNT = 1u << SUB_BITS;
+    static constexpr unsigned BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    static unsigned bucket_of(uint64_t v) {
+        if (v < SUB_COUNT) {
+            return static_cast<unsigned>(v);
+        }
+        unsigned e = std::bit_width(v) - 1;
+        unsigned mantissa = static_cast<unsigned>(v >> (e - SUB_BITS)) & (SUB_COUNT - 1);
+        return ((e - SUB_BITS + 1) << SUB_BITS) + mantissa;
+    }
+
+    // Верхняя граница значений, попадающих в корзину
+    static uint64_t bucket_upper(unsigned idx) {
+        if (idx < SUB_COUNT) {
+            return idx;
+        }
+        unsigned e = (idx >> SUB_BITS) + SUB_BITS - 1;
+        uint64_t lower = uint64_t(SUB_COUNT + (idx & (SUB_COUNT - 1))) << (e - SUB_BITS);
+        return lower + (uint64_t(1) << (e - SUB_BITS)) - 1;
+    }
+
+    void record(uint64_t v) {
+        bump(buckets[bucket_of(v)], 1);
+        bump(count, 1);
+        bump(sum, v);
+        if (v > max.load(std::memory_order_relaxed)) {
+            max.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    LatencySnapshot snapshot() const {
+        LatencySnapshot s;
+        s.buckets.resize(BUCKETS);
+        for (unsigned i = 0; i < BUCKETS; i++) {
+            s.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        }
+        s.count = count.load(std::memory_order_relaxed);
+        s.sum = sum.load(std::memory_order_relaxed);
+        s.max = max.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+
+    // Писатель один, поэтому хватает load + store без RMW
+    static void bump(std::atomic<uint64_t>& a, uint64_t v) {
+        a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+};
+
+inline void LatencySnapshot::merge(const LatencySnapshot& other) {
+    if (buckets.size() < other.buckets.size()) {
+        buckets.resize(other.buckets.size());
+    }
+    for (size_t i = 0; i < other.buckets.size(); i++) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+inline uint64_t LatencySnapshot::percentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(q * count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank && buckets[i] > 0) {
+            return std::min(LatencyHistogram::bucket_upper(static_cast<unsigned>(i)), max);
+        }
+    }
+    return max;
+}
+
+// Интерфейс очереди готовых задач
+class TaskQueue {
+public:
+    virtual ~TaskQueue() = default;
+    // Приоритет учитывает только PriorityQueue, остальные очереди — FIFO
+    virtual void push(TaskId task_id, Priority prio = Priority::Normal) = 0;
+    // Пачка задач одной операцией очереди и одним пробуждением
+    virtual void push_bulk(const TaskId* ids, size_t n,
+                           Priority prio = Priority::Normal) = 0;
+    // Блокируется, пока не появится задача; false — запрошена остановка
+    virtual bool pop(TaskId& task_id, unsigned worker, std::stop_token& stoken) = 0;
+    // Будит всех спящих обработчиков (вызывается после request_stop)
+    virtual void wake_all() = 0;
+    // Гистограмма ожидания в очереди для класса (пустая, если не ведётся)
+    virtual LatencySnapshot queue_wait(Priority) const { return {}; }
+    // Сколько задач ждёт в очереди сейчас (приблизительно)
+    virtual size_t depth() = 0;
+    // Вынимает из очереди самую новую принятую через admission задачу
+    // класса младше prio; NO_TASK — вытеснять нечего (или очередь не умеет)
+    virtual TaskId shed(Priority) { return NO_TASK; }
+    // Без ожидания: вынимает любую оставшуюся задачу (после остановки
+    // обработчиков, чтобы отменить недоделанное)
+    virtual bool try_take(TaskId& task_id) = 0;
+
+    // Сколько раз захват замка очереди натыкался на занятый замок
+    uint64_t lock_contentions() const {
+        return contended.load(std::memory_order_relaxed);
+    }
+
+protected:
+    std::unique_lock<std::mutex> lock_counted(std::mutex& m) {
+        std::unique_lock<std::mutex> lock(m, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            contended.fetch_add(1, std::memory_order_relaxed);
+            lock.lock();
+        }
+        return lock;
+    }
+
+private:
+    std::atomic<uint64_t> contended{0};
+};
+
+// Подсказка процессору внутри цикла ожидания
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Индекс обработчика в текущем потоке (-1 для клиентских потоков)
+inline thread_local int current_worker = -1;
+
+// Очередь, которую разбирает текущий обработчик (nullptr у клиентских потоков)
+inline thread_local const TaskQueue* current_queue = nullptr;
+
+// Пул памяти для обёрток задач. Блоки разбиты на классы размеров (степени
+// двойки от 64 байт), у каждого потока свой кэш свободных блоков, излишки и
+// недостача идут через склад своего узла NUMA пачками. Память берётся у
+// системы кусками и живёт до конца процесса, поэтому в установившемся режиме
+// add_task и освобождение задачи не обращаются к malloc вовсе. Новый кусок
+// нарезает сам поток, так что по первому касанию он ложится на его узел.
+class WrapperPool {
+public:
+    static constexpr size_t MIN_SHIFT = 6;       // наименьший блок — 64 байта
+    static constexpr size_t CLASS_COUNT = 6;     // 64 .. 2048 байт
+    static constexpr size_t CACHE_LIMIT = 512;   // блоков одного класса в кэше потока
+    static constexpr size_t BATCH = 128;         // блоков за одну передачу со склада
+    static constexpr size_t CHUNK_BYTES = 64 * 1024;
+    static constexpr size_t MAX_NODES = 8;       // складов; узлы сверх — по модулю
+
+    struct Stats {
+        uint64_t system_allocs;   // куски, взятые у системы
+        uint64_t oversize_allocs; // обёртки крупнее наибольшего класса
+        uint64_t depot_refills;   // пачки, взятые со склада
+        uint64_t depot_spills;    // пачки, сданные на склад
+        uint64_t bytes_reserved;
+    };
+
+    static void* allocate(size_t size) {
+        size_t cls = size_class(size);
+        if (cls >= CLASS_COUNT) {
+            counters.oversize_allocs.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+        ThreadCache& cache = thread_cache;
+        if (!cache.head[cls]) {
+            refill(cache, cls);
+        }
+        FreeBlock* block = cache.head[cls];
+        cache.head[cls] = block->next;
+        cache.count[cls]--;
+        return block;
+    }
+
+    static void deallocate(void* p, size_t size) {
+        size_t cls = size_class(size);
+        if (cls >= CLASS_COUNT) {
+            ::operator delete(p);
+            return;
+        }
+        ThreadCache& cache = thread_cache;
+        auto* block = static_cast<FreeBlock*>(p);
+        block->next = cache.head[cls];
+        cache.head[cls] = block;
+        if (++cache.count[cls] > CACHE_LIMIT) {
+            spill(cache, cls, BATCH);
+        }
+    }
+
+    static Stats stats() {
+        return Stats{
+            counters.system_allocs.load(std::memory_order_relaxed),
+            counters.oversize_allocs.load(std::memory_order_relaxed),
+            counters.depot_refills.load(std::memory_order_relaxed),
+            counters.depot_spills.load(std::memory_order_relaxed),
+            counters.bytes_reserved.load(std::memory_order_relaxed),
+        };
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct alignas(64) Depot {
+        std::mutex mtx;
+        FreeBlock* head = nullptr;
+    };
+
+    struct ThreadCache {
+        FreeBlock* head[CLASS_COUNT] = {};
+        size_t count[CLASS_COUNT] = {};
+        // Склад узла потока; определяется при первом обращении к складу
+        size_t node = MAX_NODES;
+
+        ~ThreadCache() {
+            for (size_t cls = 0; cls < CLASS_COUNT; cls++) {
+                spill(*this, cls, count[cls]);
+            }
+        }
+    };
+
+    struct Counters {
+        std::atomic<uint64_t> system_allocs{0};
+        std::atomic<uint64_t> oversize_allocs{0};
+        std::atomic<uint64_t> depot_refills{0};
+        std::atomic<uint64_t> depot_spills{0};
+        std::atomic<uint64_t> bytes_reserved{0};
+    };
+
+    static Depot depots[MAX_NODES][CLASS_COUNT];
+    static Counters counters;
+    static thread_local ThreadCache thread_cache;
+
+    static size_t size_class(size_t size) {
+        size_t shift = size <= 1 ? 0 : std::bit_width(size - 1);
+        return shift <= MIN_SHIFT ? 0 : shift - MIN_SHIFT;
+    }
+
+    static size_t block_size(size_t cls) {
+        return size_t(1) << (cls + MIN_SHIFT);
+    }
+
+    static size_t cache_node(ThreadCache& cache) {
+        if (cache.node == MAX_NODES) {
+            cache.node = thread_node() % MAX_NODES;
+        }
+        return cache.node;
+    }
+
+    static bool take_from(Depot& depot, ThreadCache& cache, size_t cls) {
+        std::lock_guard<std::mutex> lock(depot.mtx);
+        FreeBlock*& head = depot.head;
+        while (head && cache.count[cls] < BATCH) {
+            FreeBlock* block = head;
+            head = block->next;
+            block->next = cache.head[cls];
+            cache.head[cls] = block;
+            cache.count[cls]++;
+        }
+        return cache.head[cls] != nullptr;
+    }
+
+    // Сначала склад своего узла, затем чужие (лучше чужой блок, чем рост
+    // памяти без предела), и только потом новый кусок
+    static void refill(ThreadCache& cache, size_t cls) {
+        size_t home = cache_node(cache);
+        for (size_t i = 0; i < MAX_NODES; i++) {
+            if (take_from(depots[(home + i) % MAX_NODES][cls], cache, cls)) {
+                counters.depot_refills.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        // Склад пуст — режем новый кусок на блоки прямо в кэш потока
+        size_t bsize = block_size(cls);
+        auto* chunk = static_cast<char*>(::operator new(CHUNK_BYTES, std::align_val_t(64)));
+        for (size_t off = 0; off + bsize <= CHUNK_BYTES; off += bsize) {
+            auto* block = reinterpret_cast<FreeBlock*>(chunk + off);
+            block->next = cache.head[cls];
+            cache.head[cls] = block;
+            cache.count[cls]++;
+        }
+        counters.system_allocs.fetch_add(1, std::memory_order_relaxed);
+        counters.bytes_reserved.fetch_add(CHUNK_BYTES, std::memory_order_relaxed);
+    }
+
+    static void spill(ThreadCache& cache, size_t cls, size_t n) {
+        if (n == 0) {
+            return;
+        }
+        FreeBlock* first = cache.head[cls];
+        FreeBlock* last = first;
+        for (size_t i = 1; i < n; i++) {
+            last = last->next;
+        }
+        cache.head[cls] = last->next;
+        cache.count[cls] -= n;
+
+        Depot& depot = depots[cache_node(cache)][cls];
+        std::lock_guard<std::mutex> lock(depot.mtx);
+        last->next = depot.head;
+        depot.head = first;
+        counters.depot_spills.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+inline WrapperPool::Depot WrapperPool::depots[WrapperPool::MAX_NODES][WrapperPool::CLASS_COUNT];
+inline WrapperPool::Counters WrapperPool::counters;
+inline thread_local WrapperPool::ThreadCache WrapperPool::thread_cache;
+
+// Base class for type erasure. Кроме execute() здесь общий для всех задач
+// протокол завершения: готовность — одно атомарное слово PENDING -> READY,
+// ждущий поток ставит WAITING перед сном, и только тогда исполнитель делает
+// notify (через промежуточное WAKING). Там же слот продолжения, которое
+// исполнитель запускает следом.
+class TaskWrapperBase {
+    static constexpr uint32_t PENDING = 0;
+    static constexpr uint32_t WAITING = 1;
+    static constexpr uint32_t READY = 2;
+    static constexpr uint32_t WAKING = 3; // ждущего будят, READY ещё впереди
+    static constexpr int SPIN_LIMIT = 256;
+
+    std::atomic<uint32_t> state{PENDING};
+    // NO_TASK — продолжения нет, CLOSED_TASK — задача уже завершилась
+    std::atomic<TaskId> continuation{NO_TASK};
+    bool detached = false;
+    // Задача занимает место в AdmissionControl, пока не начнёт выполняться
+    bool admitted = false;
+    std::atomic<bool> cancelled{false};
+    // Узел графа задач: число незавершённых предшественников и последователи
+    std::atomic<uint32_t> pending_deps{0};
+    std::unique_ptr<std::vector<TaskId>> successors;
+    // Момент постановки в очередь (0 — не засекали)
+    uint64_t enqueued_ns = 0;
+
+public:
+    virtual ~TaskWrapperBase() = default;
+    // Выполняет задачу и сохраняет результат; готовность публикует finish()
+    virtual void execute() = 0;
+
+    // Обёртки живут в WrapperPool; виртуальный деструктор передаёт в
+    // operator delete размер настоящего типа
+    static void* operator new(size_t size) { return WrapperPool::allocate(size); }
+    static void operator delete(void* p, size_t size) { WrapperPool::deallocate(p, size); }
+
+    // Задача без получателя результата: исполнитель удаляет её сам
+    void set_detached() { detached = true; }
+    void set_enqueue_time(uint64_t ns) { enqueued_ns = ns; }
+    uint64_t enqueue_time() const { return enqueued_ns; }
+    bool is_detached() const { return detached; }
+
+    void set_admitted() { admitted = true; }
+    bool is_admitted() const { return admitted; }
+    // true — место в admission ещё не вернули; возвращает тот, кто снял флаг
+    bool take_admission() { return std::exchange(admitted, false); }
+
+    // Отменённая задача не выполняется: finish() публикует готовность,
+    // а получатель результата видит TaskCancelled
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+    // Вызывается вместо execute() у отменённой задачи
+    virtual void on_cancel() {}
+
+    void add_successor(TaskId next) {
+        if (!successors) {
+            successors = std::make_unique<std::vector<TaskId>>();
+        }
+        successors->push_back(next);
+    }
+    const std::vector<TaskId>* get_successors() const { return successors.get(); }
+
+    void add_dependency() { pending_deps.fetch_add(1, std::memory_order_relaxed); }
+    // true — это был последний предшественник, задача готова к запуску
+    bool release_dependency() {
+        return pending_deps.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    bool has_dependencies() const {
+        return pending_deps.load(std::memory_order_acquire) > 0;
+    }
+
+    // false — задача уже завершилась, продолжение надо поставить в очередь
+    bool attach_continuation(TaskId next) {
+        TaskId expected = NO_TASK;
+        return continuation.compare_exchange_strong(expected, next, std::memory_order_acq_rel);
+    }
+
+    // Вызывается исполнителем после execute(). Продолжение снимается до
+    // публикации готовности: после неё владелец дескриптора вправе удалить
+    // обёртку. Возвращает продолжение, которое надо выполнить следом.
+    TaskId finish() {
+        TaskId next = continuation.exchange(CLOSED_TASK, std::memory_order_acq_rel);
+        uint32_t expected = PENDING;
+        if (state.compare_exchange_strong(expected, READY, std::memory_order_acq_rel)) {
+            return next;
+        }
+        // Ждущий спит. Увидев READY, он вправе сразу удалить обёртку (крупные
+        // уходят прямо в ::operator delete), поэтому notify делается при
+        // WAKING: из wait_ready ждущий не выйдет, пока не увидит READY.
+        // Запись READY — последнее обращение исполнителя к обёртке.
+        state.store(WAKING, std::memory_order_relaxed);
+        state.notify_all();
+        state.store(READY, std::memory_order_release);
+        return next;
+    }
+
+    void wait_ready() {
+        for (int i = 0; i < SPIN_LIMIT; i++) {
+            if (state.load(std::memory_order_acquire) == READY) {
+                return;
+            }
+            cpu_relax();
+        }
+
+        uint32_t s = state.load(std::memory_order_acquire);
+        while (s != READY) {
+            if (s == PENDING && !state.compare_exchange_weak(s, WAITING, std::memory_order_acquire)) {
+                continue;
+            }
+            if (s == WAKING) {
+                // Исполнитель между notify и READY — считанные такты
+                cpu_relax();
+                s = state.load(std::memory_order_acquire);
+                continue;
+            }
+            state.wait(WAITING, std::memory_order_acquire);
+            s = state.load(std::memory_order_acquire);
+        }
+    }
+
+    bool is_ready() const {
+        return state.load(std::memory_order_acquire) == READY;
+    }
+};
+
+// Типизированное состояние задачи: результат хранится как есть, без std::any
+template<typename R>
+class TaskState : public TaskWrapperBase {
+    using Storage = std::conditional_t<std::is_void_v<R>, std::monostate, R>;
+
+    std::optional<Storage> result;
+
+protected:
+    template<typename... V>
+    void set_result(V&&... value) {
+        result.emplace(std::forward<V>(value)...);
+    }
+
+public:
+    // Ждёт завершения и забирает результат перемещением. Флаг отмены
+    // публикуется вместе с готовностью, поэтому после wait_ready он точен.
+    R take() {
+        wait_ready();
+        if (this->is_cancelled()) {
+            throw TaskCancelled();
+        }
+        if constexpr (!std::is_void_v<R>) {
+            return std::move(*result);
+        }
+    }
+};
+
+template<typename F, typename... Args>
+class TaskWrapper : public TaskState<std::invoke_result_t<F&, Args&...>> {
+    using R = std::invoke_result_t<F&, Args&...>;
+
+    F func;
+    std::tuple<Args...> args;
+
+public:
+    TaskWrapper(F f, Args... as) 
+        : func(std::move(f)), args(std::forward<Args>(as)...) {}
+
+    void execute() override {
+        if constexpr (std::is_void_v<R>) {
+            std::apply(func, args);
+            this->set_result();
+        } else {
+            this->set_result(std::apply(func, args));
+        }
+    }
+
+    // Функтор может узнать об отмене, определив on_cancel()
+    void on_cancel() override {
+        if constexpr (requires { func.on_cancel(); }) {
+            func.on_cancel();
+        }
+    }
+};
+
+// Таблица задач: массив слотов, разбитый на сегменты фиксированного размера.
+// Идентификатор задачи = индекс слота + поколение слота, поэтому поиск —
+// это O(1) без замков, а устаревший id после освобождения слота не находится.
+// Освобождённые слоты переиспользуются через lock-free стек.
+class TaskTable {
+    static constexpr uint32_t INDEX_BITS = 22;
+    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static constexpr uint32_t GEN_MASK = (1u << (32 - INDEX_BITS)) - 1;
+    static constexpr uint32_t SEGMENT_BITS = 12;
+    static constexpr uint32_t SEGMENT_SIZE = 1u << SEGMENT_BITS;
+    static constexpr uint32_t SEGMENT_COUNT = 1u << (INDEX_BITS - SEGMENT_BITS);
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    struct Slot {
+        std::atomic<uint32_t> generation{0};
+        std::atomic<uint32_t> next_free{NO_SLOT};
+        std::atomic<TaskWrapperBase*> task{nullptr};
+    };
+
+    std::atomic<Slot*> segments[SEGMENT_COUNT] = {};
+    std::atomic<uint32_t> next_unused{0};
+    // Вершина стека свободных слотов: старшие 32 бита — метка против ABA
+    std::atomic<uint64_t> free_head{NO_SLOT};
+
+    Slot& slot_at(uint32_t index) {
+        return segments[index >> SEGMENT_BITS].load(std::memory_order_acquire)
+            [index & (SEGMENT_SIZE - 1)];
+    }
+
+    void ensure_segment(uint32_t index) {
+        std::atomic<Slot*>& seg = segments[index >> SEGMENT_BITS];
+        if (seg.load(std::memory_order_acquire)) {
+            return;
+        }
+        Slot* fresh = new Slot[SEGMENT_SIZE];
+        Slot* expected = nullptr;
+        if (!seg.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)) {
+            delete[] fresh;
+        }
+    }
+
+    uint32_t pop_free() {
+        uint64_t head = free_head.load(std::memory_order_acquire);
+        for (;;) {
+            uint32_t index = static_cast<uint32_t>(head);
+            if (index == NO_SLOT) {
+                return NO_SLOT;
+            }
+            uint32_t next = slot_at(index).next_free.load(std::memory_order_relaxed);
+            uint64_t tag = (head >> 32) + 1;
+            if (free_head.compare_exchange_weak(head, (tag << 32) | next,
+                                                std::memory_order_acq_rel)) {
+                return index;
+            }
+        }
+    }
+
+    void push_free(uint32_t index) {
+        uint64_t head = free_head.load(std::memory_order_relaxed);
+        for (;;) {
+            slot_at(index).next_free.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+            uint64_t tag = (head >> 32) + 1;
+            if (free_head.compare_exchange_weak(head, (tag << 32) | index,
+                                                std::memory_order_release)) {
+                return;
+            }
+        }
+    }
+
+public:
+    TaskTable() = default;
+    TaskTable(const TaskTable&) = delete;
+    TaskTable& operator=(const TaskTable&) = delete;
+
+    ~TaskTable() {
+        for (auto& seg : segments) {
+            Slot* s = seg.load();
+            if (!s) {
+                continue;
+            }
+            for (uint32_t i = 0; i < SEGMENT_SIZE; i++) {
+                delete s[i].task.load();
+            }
+            delete[] s;
+        }
+    }
+
+    TaskId insert(std::unique_ptr<TaskWrapperBase> task) {
+        uint32_t index = pop_free();
+        if (index == NO_SLOT) {
+            index = next_unused.fetch_add(1, std::memory_order_relaxed);
+            // Два последних индекса заняты под NO_TASK и CLOSED_TASK
+            if (index >= INDEX_MASK - 1) {
+                next_unused.fetch_sub(1, std::memory_order_relaxed);
+                throw std::runtime_error("Task table is full");
+            }
+            ensure_segment(index);
+        }
+        Slot& slot = slot_at(index);
+        slot.task.store(task.release(), std::memory_order_release);
+        uint32_t gen = slot.generation.load(std::memory_order_relaxed) & GEN_MASK;
+        return (gen << INDEX_BITS) | index;
+    }
+
+    TaskWrapperBase* find(TaskId id) {
+        uint32_t index = id & INDEX_MASK;
+        if (index >= next_unused.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        Slot& slot = slot_at(index);
+        if ((slot.generation.load(std::memory_order_acquire) & GEN_MASK) != (id >> INDEX_BITS)) {
+            return nullptr;
+        }
+        return slot.task.load(std::memory_order_acquire);
+    }
+
+    // Удаляет задачу и возвращает слот в свободный список
+    void release(TaskId id) {
+        uint32_t index = id & INDEX_MASK;
+        Slot& slot = slot_at(index);
+        std::unique_ptr<TaskWrapperBase> task(slot.task.exchange(nullptr, std::memory_order_acq_rel));
+        slot.generation.fetch_add(1, std::memory_order_release);
+        push_free(index);
+    }
+};
+
+// Общая FIFO-очередь: все производители и обработчики делят один замок
+class GlobalQueue : public TaskQueue {
+    std::queue<TaskId> tasks;
+    std::mutex mtx;
+    std::condition_variable cond_var;
+
+public:
+    void push(TaskId task_id, Priority) override {
+        {
+            auto lock = lock_counted(mtx);
+            tasks.push(task_id);
+        }
+        cond_var.notify_one();
+    }
+
+    void push_bulk(const TaskId* ids, size_t n, Priority) override {
+        {
+            auto lock = lock_counted(mtx);
+            for (size_t i = 0; i < n; i++) {
+                tasks.push(ids[i]);
+            }
+        }
+        if (n > 1) {
+            cond_var.notify_all();
+        } else {
+            cond_var.notify_one();
+        }
+    }
+
+    bool pop(TaskId& task_id, unsigned, std::stop_token& stoken) override {
+        auto lock = lock_counted(mtx);
+        cond_var.wait(lock, [this, &stoken] {
+            return !tasks.empty() || stoken.stop_requested();
+        });
+
+        if (stoken.stop_requested()) {
+            return false;
+        }
+        task_id = tasks.front();
+        tasks.pop();
+        return true;
+    }
+
+    void wake_all() override {
+        {
+            // Пустой захват: обработчик либо ещё не проверил предикат,
+            // либо уже спит и получит notify
+            auto lock = lock_counted(mtx);
+        }
+        cond_var.notify_all();
+    }
+
+    size_t depth() override {
+        auto lock = lock_counted(mtx);
+        return tasks.size();
+    }
+
+    bool try_take(TaskId& task_id) override {
+        auto lock = lock_counted(mtx);
+        if (tasks.empty()) {
+            return false;
+        }
+        task_id = tasks.front();
+        tasks.pop();
+        return true;
+    }
+};
+
+// Деки обработчиков. Владелец берёт задачи с конца своего дека (LIFO,
+// горячий кэш), остальные воруют с начала. Клиентские потоки раскладывают
+// задачи по декам по кругу, обработчики — в свой собственный.
+class WorkStealingQueue : public TaskQueue {
+    struct alignas(64) WorkerDeque {
+        std::mutex mtx;
+        std::deque<TaskId> tasks;
+    };
+
+    unsigned count;
+    std::unique_ptr<WorkerDeque[]> deques;
+    std::atomic<unsigned> next_deque{0};
+    // epoch растёт на каждый push и на остановку; спящие ждут его изменения
+    std::atomic<uint32_t> epoch{0};
+    std::atomic<unsigned> sleepers{0};
+
+    bool try_pop_local(unsigned worker, TaskId& task_id) {
+        WorkerDeque& d = deques[worker];
+        auto lock = lock_counted(d.mtx);
+        if (d.tasks.empty()) {
+            return false;
+        }
+        task_id = d.tasks.back();
+        d.tasks.pop_back();
+        return true;
+    }
+
+    bool try_steal(unsigned worker, TaskId& task_id) {
+        for (unsigned i = 1; i < count; i++) {
+            WorkerDeque& d = deques[(worker + i) % count];
+            std::unique_lock<std::mutex> lock(d.mtx, std::try_to_lock);
+            if (lock.owns_lock() && !d.tasks.empty()) {
+                task_id = d.tasks.front();
+                d.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool try_pop(unsigned worker, TaskId& task_id) {
+        return try_pop_local(worker, task_id) || try_steal(worker, task_id);
+    }
+
+    // Индекс дека текущего потока, если это обработчик именно этой очереди
+    int own_worker() const {
+        return current_queue == this ? current_worker : -1;
+    }
+
+    // Полный обход с блокирующим захватом: перед сном нельзя пропустить
+    // задачу из-за занятого замка
+    bool try_steal_blocking(unsigned worker, TaskId& task_id) {
+        for (unsigned i = 0; i < count; i++) {
+            WorkerDeque& d = deques[(worker + i) % count];
+            auto lock = lock_counted(d.mtx);
+            if (!d.tasks.empty()) {
+                task_id = d.tasks.front();
+                d.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    explicit WorkStealingQueue(unsigned workers)
+        : count(workers), deques(new WorkerDeque[workers]) {}
+
+    void push(TaskId task_id, Priority) override {
+        int own = own_worker();
+        unsigned target = own >= 0
+            ? static_cast<unsigned>(own)
+            : next_deque.fetch_add(1, std::memory_order_relaxed) % count;
+        {
+            auto lock = lock_counted(deques[target].mtx);
+            deques[target].tasks.push_back(task_id);
+        }
+        epoch.fetch_add(1);
+        if (sleepers.load() > 0) {
+            epoch.notify_one();
+        }
+    }
+
+    // Обработчик кладёт пачку в свой дек (остальные её раскрадут), клиент —
+    // делит пачку на непрерывные куски по всем декам, по одному захвату на дек
+    void push_bulk(const TaskId* ids, size_t n, Priority) override {
+        if (n == 0) {
+            return;
+        }
+        int own = own_worker();
+        if (own >= 0) {
+            WorkerDeque& d = deques[own];
+            auto lock = lock_counted(d.mtx);
+            d.tasks.insert(d.tasks.end(), ids, ids + n);
+        } else {
+            unsigned first = next_deque.fetch_add(1, std::memory_order_relaxed);
+            size_t part = (n + count - 1) / count;
+            for (size_t off = 0, k = 0; off < n; off += part, k++) {
+                WorkerDeque& d = deques[(first + k) % count];
+                size_t len = std::min(part, n - off);
+                auto lock = lock_counted(d.mtx);
+                d.tasks.insert(d.tasks.end(), ids + off, ids + off + len);
+            }
+        }
+        epoch.fetch_add(1);
+        if (sleepers.load() > 0) {
+            epoch.notify_all();
+        }
+    }
+
+    bool pop(TaskId& task_id, unsigned worker, std::stop_token& stoken) override {
+        while (!stoken.stop_requested()) {
+            if (try_pop(worker, task_id)) {
+                return true;
+            }
+
+            // Сначала объявляем себя спящим, затем перепроверяем деки:
+            // push либо увидит sleepers > 0, либо его задача найдётся здесь
+            sleepers.fetch_add(1);
+            uint32_t e = epoch.load();
+            if (stoken.stop_requested()) {
+                sleepers.fetch_sub(1);
+                return false;
+            }
+            if (try_steal_blocking(worker, task_id)) {
+                sleepers.fetch_sub(1);
+                return true;
+            }
+            epoch.wait(e);
+            sleepers.fetch_sub(1);
+        }
+        return false;
+    }
+
+    void wake_all() override {
+        epoch.fetch_add(1);
+        epoch.notify_all();
+    }
+
+    size_t depth() override {
+        size_t n = 0;
+        for (unsigned i = 0; i < count; i++) {
+            auto lock = lock_counted(deques[i].mtx);
+            n += deques[i].tasks.size();
+        }
+        return n;
+    }
+
+    bool try_take(TaskId& task_id) override {
+        return try_steal_blocking(0, task_id);
+    }
+};
+
+// Очередь на каждый узел NUMA. Обработчик берёт задачи своего узла и ходит
+// к чужим узлам, только когда у своего пусто. Клиент кладёт задачу в очередь
+// узла, на котором выполняется сам: там же лежит и её обёртка из WrapperPool.
+class NumaQueue : public TaskQueue {
+    struct alignas(64) NodeQueue {
+        std::mutex mtx;
+        std::deque<TaskId> tasks;
+    };
+
+    unsigned count;
+    std::unique_ptr<NodeQueue[]> queues;
+    std::vector<unsigned> worker_slot; // очередь узла каждого обработчика
+    std::vector<int> node_slot;        // очередь по номеру узла, -1 — нет обработчиков
+    std::atomic<unsigned> next_slot{0};
+    std::atomic<uint32_t> epoch{0};
+    std::atomic<unsigned> sleepers{0};
+
+    unsigned home_slot() const {
+        if (current_queue == this && current_worker >= 0) {
+            return worker_slot[current_worker];
+        }
+        unsigned node = thread_node();
+        if (node < node_slot.size() && node_slot[node] >= 0) {
+            return static_cast<unsigned>(node_slot[node]);
+        }
+        return 0;
+    }
+
+    // Свой узел, потом остальные по кругу; blocking — с ожиданием замков
+    bool try_pop_from(unsigned home, TaskId& task_id, bool blocking) {
+        for (unsigned i = 0; i < count; i++) {
+            NodeQueue& q = queues[(home + i) % count];
+            std::unique_lock<std::mutex> lock(q.mtx, std::defer_lock);
+            if (blocking) {
+                lock = lock_counted(q.mtx);
+            } else if (!lock.try_lock()) {
+                continue;
+            }
+            if (!q.tasks.empty()) {
+                task_id = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void signal(bool all) {
+        epoch.fetch_add(1);
+        if (sleepers.load() > 0) {
+            if (all) {
+                epoch.notify_all();
+            } else {
+                epoch.notify_one();
+            }
+        }
+    }
+
+public:
+    // worker_nodes[i] — узел обработчика i
+    explicit NumaQueue(const std::vector<unsigned>& worker_nodes) {
+        for (unsigned node : worker_nodes) {
+            if (node >= node_slot.size()) {
+                node_slot.resize(node + 1, -1);
+            }
+            if (node_slot[node] < 0) {
+                node_slot[node] = static_cast<int>(count_slots());
+            }
+            worker_slot.push_back(static_cast<unsigned>(node_slot[node]));
+        }
+        count = count_slots();
+        queues.reset(new NodeQueue[count]);
+    }
+
+    unsigned nodes() const { return count; }
+
+    void push(TaskId task_id, Priority) override {
+        NodeQueue& q = queues[home_slot()];
+        {
+            auto lock = lock_counted(q.mtx);
+            q.tasks.push_back(task_id);
+        }
+        signal(false);
+    }
+
+    void push_bulk(const TaskId* ids, size_t n, Priority) override {
+        if (n == 0) {
+            return;
+        }
+        NodeQueue& q = queues[home_slot()];
+        {
+            auto lock = lock_counted(q.mtx);
+            q.tasks.insert(q.tasks.end(), ids, ids + n);
+        }
+        signal(n > 1);
+    }
+
+    bool pop(TaskId& task_id, unsigned worker, std::stop_token& stoken) override {
+        unsigned home = worker_slot[worker];
+        while (!stoken.stop_requested()) {
+            if (try_pop_from(home, task_id, false)) {
+                return true;
+            }
+
+            // Протокол сна тот же, что у WorkStealingQueue
+            sleepers.fetch_add(1);
+            uint32_t e = epoch.load();
+            if (stoken.stop_requested()) {
+                sleepers.fetch_sub(1);
+                return false;
+            }
+            if (try_pop_from(home, task_id, true)) {
+                sleepers.fetch_sub(1);
+                return true;
+            }
+            epoch.wait(e);
+            sleepers.fetch_sub(1);
+        }
+        return false;
+    }
+
+    void wake_all() override {
+        epoch.fetch_add(1);
+        epoch.notify_all();
+    }
+
+    size_t depth() override {
+        size_t n = 0;
+        for (unsigned i = 0; i < count; i++) {
+            auto lock = lock_counted(queues[i].mtx);
+            n += queues[i].tasks.size();
+        }
+        return n;
+    }
+
+    bool try_take(TaskId& task_id) override {
+        return try_pop_from(0, task_id, true);
+    }
+
+private:
+    unsigned count_slots() const {
+        unsigned n = 0;
+        for (int slot : node_slot) {
+            if (slot >= 0) {
+                n++;
+            }
+        }
+        return n;
+    }
+};
+
+// Ограниченное lock-free кольцо (MPMC по Вьюкову): у каждой ячейки свой
+// номер последовательности, производители и потребители двигают свои курсоры
+// CAS-ом. Замков нет; спим только на пустом или полном кольце через atomic wait.
+// Исключение — собственный обработчик на полном кольце: кроме обработчиков
+// кольцо никто не разгружает, поэтому он не спит, а кладёт задачу в
+// неограниченный список переполнения под замком; pop() разбирает его первым.
+class RingBufferQueue : public TaskQueue {
+    struct Cell {
+        std::atomic<size_t> sequence;
+        TaskId task_id;
+    };
+
+    size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+    // Эпохи для сна: трогаются только при наличии ждущих
+    alignas(64) std::atomic<uint32_t> pushed{0};
+    std::atomic<unsigned> waiting_consumers{0};
+    alignas(64) std::atomic<uint32_t> popped{0};
+    std::atomic<unsigned> waiting_producers{0};
+    alignas(64) std::atomic<size_t> overflow_size{0};
+    std::mutex overflow_mtx;
+    std::deque<TaskId> overflow;
+
+    static size_t round_up_pow2(size_t n) {
+        size_t p = 2;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    bool try_push(TaskId task_id) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.task_id = task_id;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // полно
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(TaskId& task_id) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    task_id = cell.task_id;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // пусто
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Будим противоположную сторону, только если кто-то спит. Барьер
+    // упорядочивает публикацию ячейки с чтением счётчика ждущих.
+    static void signal(std::atomic<uint32_t>& epoch, std::atomic<unsigned>& waiters) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            epoch.fetch_add(1);
+            epoch.notify_all();
+        }
+    }
+
+    bool try_pop_overflow(TaskId& task_id) {
+        if (overflow_size.load() == 0) {
+            return false;
+        }
+        auto lock = lock_counted(overflow_mtx);
+        if (overflow.empty()) {
+            return false;
+        }
+        task_id = overflow.front();
+        overflow.pop_front();
+        overflow_size.fetch_sub(1);
+        return true;
+    }
+
+    bool try_pop_any(TaskId& task_id) {
+        return try_pop_overflow(task_id) || try_pop(task_id);
+    }
+
+    // Кладёт задачу, засыпая на полном кольце. Перед сном будит потребителей:
+    // у пачки сигнал отложен до конца, а без него кольцо никто не разгрузит.
+    // Собственный обработчик не спит никогда — иначе пул встанет.
+    void push_blocking(TaskId task_id) {
+        while (!try_push(task_id)) {
+            if (current_queue == this && current_worker >= 0) {
+                auto lock = lock_counted(overflow_mtx);
+                overflow.push_back(task_id);
+                overflow_size.fetch_add(1);
+                return;
+            }
+            signal(pushed, waiting_consumers);
+            waiting_producers.fetch_add(1);
+            uint32_t e = popped.load();
+            if (try_push(task_id)) {
+                waiting_producers.fetch_sub(1);
+                break;
+            }
+            popped.wait(e);
+            waiting_producers.fetch_sub(1);
+        }
+    }
+
+public:
+    explicit RingBufferQueue(size_t capacity)
+        : mask(round_up_pow2(capacity) - 1), cells(new Cell[mask + 1]) {
+        for (size_t i = 0; i <= mask; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    void push(TaskId task_id, Priority) override {
+        push_blocking(task_id);
+        signal(pushed, waiting_consumers);
+    }
+
+    void push_bulk(const TaskId* ids, size_t n, Priority) override {
+        for (size_t i = 0; i < n; i++) {
+            push_blocking(ids[i]);
+        }
+        signal(pushed, waiting_consumers);
+    }
+
+    bool pop(TaskId& task_id, unsigned, std::stop_token& stoken) override {
+        while (!stoken.stop_requested()) {
+            if (try_pop_any(task_id)) {
+                signal(popped, waiting_producers);
+                return true;
+            }
+
+            waiting_consumers.fetch_add(1);
+            uint32_t e = pushed.load();
+            if (stoken.stop_requested()) {
+                waiting_consumers.fetch_sub(1);
+                return false;
+            }
+            if (try_pop_any(task_id)) {
+                waiting_consumers.fetch_sub(1);
+                signal(popped, waiting_producers);
+                return true;
+            }
+            pushed.wait(e);
+            waiting_consumers.fetch_sub(1);
+        }
+        return false;
+    }
+
+    void wake_all() override {
+        pushed.fetch_add(1);
+        pushed.notify_all();
+        popped.fetch_add(1);
+        popped.notify_all();
+    }
+
+    size_t depth() override {
+        size_t head = dequeue_pos.load(std::memory_order_relaxed);
+        size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+        return (tail > head ? tail - head : 0) + overflow_size.load(std::memory_order_relaxed);
+    }
+
+    // Разбор при остановке освобождает ячейки, как и pop(): производитель,
+    // уснувший на полном кольце, иначе не проснётся
+    bool try_take(TaskId& task_id) override {
+        if (!try_pop_any(task_id)) {
+            return false;
+        }
+        signal(popped, waiting_producers);
+        return true;
+    }
+};
+
+// Отдельная FIFO-очередь на каждый класс приоритета. Берётся старший
+// непустой класс, но класс, который пропустили STARVE_LIMIT[c] раз подряд
+// при наличии в нём задач, обслуживается вне очереди — фоновая работа не
+// голодает. Для каждого класса копится гистограмма ожидания в очереди.
+class PriorityQueue : public TaskQueue {
+    struct Entry {
+        TaskId id;
+        uint64_t enqueued_ns;
+    };
+
+    static constexpr unsigned STARVE_LIMIT[PRIORITY_COUNT] = {0, 4, 16};
+
+    std::deque<Entry> tasks[PRIORITY_COUNT];
+    unsigned skipped[PRIORITY_COUNT] = {};
+    LatencyHistogram wait_hist[PRIORITY_COUNT];
+    std::mutex mtx;
+    std::condition_variable cond_var;
+    TaskTable& table;
+
+    bool empty() const {
+        for (auto& q : tasks) {
+            if (!q.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t pick_class() {
+        size_t chosen = PRIORITY_COUNT;
+        for (size_t c = PRIORITY_COUNT; c-- > 1;) {
+            if (!tasks[c].empty() && skipped[c] >= STARVE_LIMIT[c]) {
+                chosen = c;
+                break;
+            }
+        }
+        if (chosen == PRIORITY_COUNT) {
+            for (size_t c = 0; c < PRIORITY_COUNT; c++) {
+                if (!tasks[c].empty()) {
+                    chosen = c;
+                    break;
+                }
+            }
+        }
+        for (size_t c = 0; c < PRIORITY_COUNT; c++) {
+            if (c == chosen) {
+                skipped[c] = 0;
+            } else if (!tasks[c].empty()) {
+                skipped[c]++;
+            }
+        }
+        return chosen;
+    }
+
+public:
+    // Таблица нужна shed(): вытесняются только задачи, принятые через admission
+    explicit PriorityQueue(TaskTable& tasks) : table(tasks) {}
+
+    void push(TaskId task_id, Priority prio) override {
+        uint64_t t = now_ns();
+        {
+            auto lock = lock_counted(mtx);
+            tasks[static_cast<size_t>(prio)].push_back({task_id, t});
+        }
+        cond_var.notify_one();
+    }
+
+    void push_bulk(const TaskId* ids, size_t n, Priority prio) override {
+        uint64_t t = now_ns();
+        {
+            auto lock = lock_counted(mtx);
+            auto& q = tasks[static_cast<size_t>(prio)];
+            for (size_t i = 0; i < n; i++) {
+                q.push_back({ids[i], t});
+            }
+        }
+        if (n > 1) {
+            cond_var.notify_all();
+        } else {
+            cond_var.notify_one();
+        }
+    }
+
+    bool pop(TaskId& task_id, unsigned, std::stop_token& stoken) override {
+        auto lock = lock_counted(mtx);
+        cond_var.wait(lock, [this, &stoken] {
+            return !empty() || stoken.stop_requested();
+        });
+
+        if (stoken.stop_requested()) {
+            return false;
+        }
+        size_t c = pick_class();
+        Entry e = tasks[c].front();
+        tasks[c].pop_front();
+        wait_hist[c].record(now_ns() - e.enqueued_ns);
+        task_id = e.id;
+        return true;
+    }
+
+    void wake_all() override {
+        {
+            auto lock = lock_counted(mtx);
+        }
+        cond_var.notify_all();
+    }
+
+    LatencySnapshot queue_wait(Priority prio) const override {
+        return wait_hist[static_cast<size_t>(prio)].snapshot();
+    }
+
+    TaskId shed(Priority prio) override {
+        auto lock = lock_counted(mtx);
+        for (size_t c = PRIORITY_COUNT; c-- > static_cast<size_t>(prio) + 1;) {
+            auto& q = tasks[c];
+            for (auto it = q.rbegin(); it != q.rend(); ++it) {
+                if (table.find(it->id)->is_admitted()) {
+                    TaskId id = it->id;
+                    q.erase(std::next(it).base());
+                    return id;
+                }
+            }
+        }
+        return NO_TASK;
+    }
+
+    bool try_take(TaskId& task_id) override {
+        auto lock = lock_counted(mtx);
+        if (empty()) {
+            return false;
+        }
+        size_t c = pick_class();
+        task_id = tasks[c].front().id;
+        tasks[c].pop_front();
+        return true;
+    }
+
+    size_t depth() override {
+        auto lock = lock_counted(mtx);
+        size_t n = 0;
+        for (auto& q : tasks) {
+            n += q.size();
+        }
+        return n;
+    }
+};
+
+// Счётчики обработчика. Каждый обработчик пишет только в свою структуру,
+// выравнивание по кэш-линии исключает ложное разделение между ними.
+struct alignas(64) WorkerStats {
+    std::atomic<uint64_t> tasks{0};
+    std::atomic<uint64_t> idle_ns{0};
+    LatencyHistogram queue_wait; // постановка в очередь -> начало выполнения
+    LatencyHistogram run_time;   // начало -> конец выполнения
+
+    void count_task() {
+        tasks.store(tasks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    void add_idle(uint64_t ns) {
+        idle_ns.store(idle_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    }
+};
+
+struct WorkerStatsSnapshot {
+    uint64_t tasks = 0;
+    uint64_t idle_ns = 0;
+    LatencySnapshot queue_wait;
+    LatencySnapshot run_time;
+};
+
+struct AdmissionStats {
+    size_t capacity = 0;
+    size_t queued = 0;
+    size_t high_water = 0;
+    uint64_t blocked = 0;
+    uint64_t rejected = 0;
+    uint64_t shed = 0;
+};
+
+// Снимок состояния сервера: по обработчикам и суммарно
+struct ServerStats {
+    std::vector<WorkerStatsSnapshot> workers;
+    uint64_t tasks = 0;
+    uint64_t idle_ns = 0;
+    size_t queue_depth = 0;
+    uint64_t lock_contentions = 0;
+    AdmissionStats admission;
+    LatencySnapshot queue_wait;
+    LatencySnapshot run_time;
+
+    void print(std::ostream& out) const {
+        out << "tasks " << tasks << ", queue depth " << queue_depth
+            << ", lock contentions " << lock_contentions
+            << ", idle " << idle_ns / 1e6 << " ms" << std::endl;
+        out << "  admission: high water " << admission.high_water;
+        if (admission.capacity > 0) {
+            out << " of " << admission.capacity;
+        }
+        out << ", blocked " << admission.blocked << ", rejected " << admission.rejected
+            << ", shed " << admission.shed << std::endl;
+        if (queue_wait.count > 0) {
+            out << "  queue wait: p50 " << queue_wait.percentile(0.5) / 1000.0
+                << " us, p99 " << queue_wait.percentile(0.99) / 1000.0
+                << " us, max " << queue_wait.max / 1000.0 << " us" << std::endl;
+        }
+        if (run_time.count > 0) {
+            out << "  run time:   p50 " << run_time.percentile(0.5) / 1000.0
+                << " us, p99 " << run_time.percentile(0.99) / 1000.0
+                << " us, max " << run_time.max / 1000.0 << " us" << std::endl;
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            out << "  worker " << i << ": " << workers[i].tasks << " tasks, idle "
+                << workers[i].idle_ns / 1e6 << " ms" << std::endl;
+        }
+    }
+};
+
+
+inline thread_local WorkerStats* current_stats = nullptr;
+
+// Ограничение числа принятых, но ещё не начатых задач. Место занимают
+// add_task/add_tasks/add_detached, освобождает обработчик, взявший задачу.
+// Внутренние задачи (продолжения, возобновление корутин, узлы графа) места
+// не занимают: они либо уже учтены, либо появляются по мере выполнения.
+// capacity == 0 — без ограничения, но пик заполнения всё равно ведётся.
+class AdmissionControl {
+    size_t capacity = 0;
+    AdmissionPolicy policy = AdmissionPolicy::Block;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> high_water{0};
+    std::atomic<bool> closed{false};
+    // Ждущие на Block спят на wake_epoch: его двигают release и close
+    std::atomic<unsigned> waiters{0};
+    std::atomic<uint32_t> wake_epoch{0};
+    std::atomic<uint64_t> blocked{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> shed_count{0};
+
+    void raise_high_water(size_t v) {
+        size_t hw = high_water.load(std::memory_order_relaxed);
+        while (v > hw && !high_water.compare_exchange_weak(hw, v, std::memory_order_relaxed)) {
+        }
+    }
+
+public:
+    // Настраивается до отправки задач
+    void configure(size_t cap, AdmissionPolicy p) {
+        capacity = cap;
+        policy = p;
+    }
+
+    // Закрытая admission отказывает всем, кроме обработчиков этого сервера:
+    // их задачи — продолжение уже принятой работы. Ждущие на Block получают
+    // отказ.
+    void close() {
+        closed.store(true);
+        wake_epoch.fetch_add(1);
+        wake_epoch.notify_all();
+    }
+    void open() { closed.store(false); }
+
+    // Код для TaskRejected после неудачного admit()
+    std::errc rejection() const {
+        return closed.load() ? std::errc::operation_not_permitted
+                             : std::errc::resource_unavailable_try_again;
+    }
+
+    // Занять место под n задач. Пачка принимается целиком, если очередь не
+    // заполнена, поэтому может превысить capacity меньше чем на n.
+    // may_block == false превращает Block в Reject (сетевой поток, try_*);
+    // обработчики не блокируются никогда — иначе некому разбирать очередь.
+    // own_worker — вызывает обработчик этого же сервера; обработчик чужого
+    // пула для него обычный клиент. shed_one(prio) вытесняет одну задачу
+    // младше prio, false — нечего.
+    template<typename ShedFn>
+    bool admit(Priority prio, size_t n, bool may_block, bool own_worker, ShedFn&& shed_one) {
+        if (closed.load() && !own_worker) {
+            rejected.fetch_add(n, std::memory_order_relaxed);
+            return false;
+        }
+        if (capacity == 0) {
+            raise_high_water(queued.fetch_add(n, std::memory_order_relaxed) + n);
+            return true;
+        }
+        bool counted_block = false;
+        for (;;) {
+            size_t cur = queued.load();
+            if (cur < capacity || own_worker) {
+                if (queued.compare_exchange_weak(cur, cur + n)) {
+                    raise_high_water(cur + n);
+                    return true;
+                }
+                continue;
+            }
+            if (policy == AdmissionPolicy::Shed && shed_one(prio)) {
+                shed_count.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (policy != AdmissionPolicy::Block || !may_block) {
+                rejected.fetch_add(n, std::memory_order_relaxed);
+                return false;
+            }
+            if (!counted_block) {
+                counted_block = true;
+                blocked.fetch_add(1, std::memory_order_relaxed);
+            }
+            // Порядок waiters++ -> load(queued) против release: queued-- -> load(waiters)
+            waiters.fetch_add(1);
+            uint32_t e = wake_epoch.load();
+            if (queued.load() >= capacity && !closed.load()) {
+                wake_epoch.wait(e);
+            }
+            waiters.fetch_sub(1);
+            if (closed.load()) {
+                rejected.fetch_add(n, std::memory_order_relaxed);
+                return false;
+            }
+        }
+    }
+
+    void release() {
+        queued.fetch_sub(1);
+        if (waiters.load() > 0) {
+            wake_epoch.fetch_add(1);
+            wake_epoch.notify_all();
+        }
+    }
+
+    AdmissionStats stats() const {
+        AdmissionStats st;
+        st.capacity = capacity;
+        st.queued = queued.load(std::memory_order_relaxed);
+        st.high_water = high_water.load(std::memory_order_relaxed);
+        st.blocked = blocked.load(std::memory_order_relaxed);
+        st.rejected = rejected.load(std::memory_order_relaxed);
+        st.shed = shed_count.load(std::memory_order_relaxed);
+        return st;
+    }
+};
+
+template<typename R>
+class TaskHandle;
+
+// Состояние одного сервера задач: очередь, таблица задач, приём задач и
+// счётчики, плюс API отправки. Серверов в процессе может быть несколько,
+// друг о друге они не знают; дескрипторы, графы и корутины держат указатель
+// на свой ServerCore. Потоки обработчиков запускает Server.
+class ServerCore {
+public:
+    ServerCore(unsigned workers_num, SchedulerMode sched, Affinity pinning)
+        : worker_count(workers_num > 0 ? workers_num : 1), mode(sched), affinity(pinning),
+          placement(plan_placement(cpu_topology(), worker_count, pinning)),
+          worker_stats(new WorkerStats[worker_count]) {
+        if (mode == SchedulerMode::Numa) {
+            std::vector<unsigned> nodes;
+            for (const ThreadPlacement& p : placement) {
+                nodes.push_back(p.node);
+            }
+            queue = std::make_unique<NumaQueue>(nodes);
+        } else if (mode == SchedulerMode::WorkStealing) {
+            queue = std::make_unique<WorkStealingQueue>(worker_count);
+        } else if (mode == SchedulerMode::LockFreeRing) {
+            queue = std::make_unique<RingBufferQueue>(RING_CAPACITY);
+        } else if (mode == SchedulerMode::Priority) {
+            queue = std::make_unique<PriorityQueue>(table);
+        } else {
+            queue = std::make_unique<GlobalQueue>();
+        }
+    }
+
+    ServerCore(const ServerCore&) = delete;
+    ServerCore& operator=(const ServerCore&) = delete;
+
+    // Бросает TaskRejected, если очередь заполнена и политика не Block
+    template<typename F, typename... Args>
+        requires std::invocable<std::decay_t<F>&, std::decay_t<Args>&...>
+    auto add_task(Priority prio, F&& func, Args&&... args) {
+        using R = std::invoke_result_t<std::decay_t<F>&, std::decay_t<Args>&...>;
+
+        if (!admit(prio, 1, true)) {
+            throw TaskRejected(admission.rejection());
+        }
+        return TaskHandle<R>(this, enqueue_admitted(prio, false, std::forward<F>(func), std::forward<Args>(args)...));
+    }
+
+    template<typename F, typename... Args>
+        requires std::invocable<std::decay_t<F>&, std::decay_t<Args>&...>
+    auto add_task(F&& func, Args&&... args) {
+        return add_task(Priority::Normal, std::forward<F>(func), std::forward<Args>(args)...);
+    }
+
+    // Без блокировки и исключений: пустой optional, если задачу не приняли
+    template<typename F, typename... Args>
+        requires std::invocable<std::decay_t<F>&, std::decay_t<Args>&...>
+    auto try_add_task(Priority prio, F&& func, Args&&... args) {
+        using R = std::invoke_result_t<std::decay_t<F>&, std::decay_t<Args>&...>;
+
+        std::optional<TaskHandle<R>> handle;
+        if (admit(prio, 1, false)) {
+            handle.emplace(this, enqueue_admitted(prio, false, std::forward<F>(func), std::forward<Args>(args)...));
+        }
+        return handle;
+    }
+
+    // Задача без результата: обёртка удаляется сразу после выполнения.
+    // Об отмене или вытеснении функтор узнаёт через on_cancel(), если он есть.
+    template<typename F, typename... Args>
+    void add_detached(F&& func, Args&&... args) {
+        if (!admit(Priority::Normal, 1, true)) {
+            throw TaskRejected(admission.rejection());
+        }
+        enqueue_admitted(Priority::Normal, true, std::forward<F>(func), std::forward<Args>(args)...);
+    }
+
+    // false — задачу не приняли, функтор не вызывался
+    template<typename F, typename... Args>
+    bool try_add_detached(F&& func, Args&&... args) {
+        if (!admit(Priority::Normal, 1, false)) {
+            return false;
+        }
+        enqueue_admitted(Priority::Normal, true, std::forward<F>(func), std::forward<Args>(args)...);
+        return true;
+    }
+
+    // Пакетная отправка: все обёртки создаются заранее, в очередь уходят одной
+    // операцией с одним пробуждением обработчиков. Место в admission пачка
+    // занимает целиком или не занимает вовсе.
+    template<typename F>
+    auto add_tasks(std::span<F> funcs, Priority prio = Priority::Normal) {
+        using WrapperType = TaskWrapper<std::decay_t<F>>;
+        using R = std::invoke_result_t<std::decay_t<F>&>;
+
+        if (!admit(prio, funcs.size(), true)) {
+            throw TaskRejected(admission.rejection());
+        }
+        std::vector<TaskId> ids;
+        ids.reserve(funcs.size());
+        for (auto& f : funcs) {
+            auto wrapper = std::make_unique<WrapperType>(f);
+            wrapper->set_admitted();
+            ids.push_back(table.insert(std::move(wrapper)));
+        }
+        enqueue_tasks(ids.data(), ids.size(), prio);
+
+        std::vector<TaskHandle<R>> handles;
+        handles.reserve(ids.size());
+        for (TaskId id : ids) {
+            handles.emplace_back(this, id);
+        }
+        return handles;
+    }
+
+    template<typename R>
+    R request_result(TaskHandle<R> handle) {
+        return handle.get();
+    }
+
+    // Ждёт все задачи пачки и возвращает результаты в том же порядке
+    template<typename R>
+    std::vector<R> request_results(std::span<TaskHandle<R>> handles) {
+        std::vector<R> res;
+        res.reserve(handles.size());
+        for (auto& h : handles) {
+            res.push_back(h.get());
+        }
+        return res;
+    }
+
+    // Для дескрипторов, графов и корутин этого сервера
+    TaskTable& tasks() { return table; }
+
+    // Постановка в очередь с отметкой времени для гистограммы ожидания
+    void enqueue_task(TaskId task_id, Priority prio = Priority::Normal) {
+        if (timing.load(std::memory_order_relaxed)) {
+            table.find(task_id)->set_enqueue_time(now_ns());
+        }
+        in_flight.fetch_add(1);
+        queue->push(task_id, prio);
+        cancel_if_stopped();
+    }
+
+    void enqueue_tasks(const TaskId* ids, size_t n, Priority prio = Priority::Normal) {
+        if (timing.load(std::memory_order_relaxed)) {
+            uint64_t t = now_ns();
+            for (size_t i = 0; i < n; i++) {
+                table.find(ids[i])->set_enqueue_time(t);
+            }
+        }
+        in_flight.fetch_add(n);
+        queue->push_bulk(ids, n, prio);
+        cancel_if_stopped();
+    }
+
+protected:
+    unsigned worker_count;
+    SchedulerMode mode;
+    Affinity affinity;
+    // Узел и процессоры каждого обработчика
+    std::vector<ThreadPlacement> placement;
+    TaskTable table;
+    std::unique_ptr<TaskQueue> queue;
+    AdmissionControl admission;
+    // Включает замеры времени (два чтения часов на задачу и два на ожидание
+    // очереди); счётчики задач ведутся всегда
+    std::atomic<bool> timing{false};
+    std::unique_ptr<WorkerStats[]> worker_stats;
+    // Сколько задач поставлено в очередь и ещё не доведено до конца (вместе
+    // с цепочкой продолжений); по нему drain() ждёт опустошения сервера
+    std::atomic<size_t> in_flight{0};
+    std::atomic<bool> drain_waiting{false};
+    // Выставляется stop() после выхода обработчиков. in_flight растёт до
+    // push, а stopped читается после него, поэтому задача, поставленная
+    // клиентом во время или после разбора очереди, не теряется: либо stop()
+    // увидит её в in_flight и дождётся, либо клиент увидит stopped и
+    // отменит её сам.
+    std::atomic<bool> stopped{false};
+
+    void worker_loop(std::stop_token stoken, unsigned worker) {
+        TaskId task_id;
+        // Привязка до первой задачи: кэш WrapperPool и стек потока ложатся
+        // на его узел
+        apply_placement(placement[worker]);
+        current_worker = static_cast<int>(worker);
+        current_queue = queue.get();
+        current_stats = &worker_stats[worker];
+
+        for (;;) {
+            bool timed = timing.load(std::memory_order_relaxed);
+            uint64_t idle_start = timed ? now_ns() : 0;
+            if (!queue->pop(task_id, worker, stoken)) {
+                break;
+            }
+            if (timed) {
+                current_stats->add_idle(now_ns() - idle_start);
+            }
+            run_task(task_id);
+        }
+    }
+
+    // Завершает задачу, вынутую из очереди, без выполнения, вместе с цепочкой
+    // продолжений
+    void cancel_task(TaskId task_id) {
+        if (TaskWrapperBase* task = table.find(task_id)) {
+            task->cancel();
+            run_task(task_id);
+        }
+    }
+
+    // Отменяет всё, что лежит в очереди. Отмена порождает новые записи
+    // (отменённые последователи графа), поэтому вынимаем до опустошения;
+    // вложенный вызов из их enqueue_tasks ничего не делает — их вынет этот
+    // же цикл.
+    void cancel_queued() {
+        static thread_local bool active = false;
+        if (active) {
+            return;
+        }
+        active = true;
+        TaskId task_id;
+        while (queue->try_take(task_id)) {
+            cancel_task(task_id);
+        }
+        active = false;
+    }
+
+    void cancel_if_stopped() {
+        if (stopped.load()) {
+            cancel_queued();
+        }
+    }
+
+private:
+    bool admit(Priority prio, size_t n, bool may_block) {
+        bool own_worker = current_worker >= 0 && current_queue == queue.get();
+        return admission.admit(prio, n, may_block, own_worker, [this](Priority p) {
+            TaskId victim = queue->shed(p);
+            if (victim == NO_TASK) {
+                return false;
+            }
+            cancel_task(victim); // возвращает место жертвы через release()
+            return true;
+        });
+    }
+
+    // Ставит в очередь задачу, место под которую уже заняли в admission
+    template<typename F, typename... Args>
+    TaskId enqueue_admitted(Priority prio, bool detached, F&& func, Args&&... args) {
+        using WrapperType = TaskWrapper<std::decay_t<F>, std::decay_t<Args>...>;
+
+        auto wrapper = std::make_unique<WrapperType>(
+            std::forward<F>(func), 
+            std::forward<Args>(args)...
+        );
+        wrapper->set_admitted();
+        if (detached) {
+            wrapper->set_detached();
+        }
+        TaskId task_id = table.insert(std::move(wrapper));
+        enqueue_task(task_id, prio);
+        return task_id;
+    }
+
+    void task_done() {
+        if (in_flight.fetch_sub(1) == 1 && drain_waiting.load()) {
+            in_flight.notify_all();
+        }
+    }
+
+    // Узел графа завершён: последователи, у которых не осталось незавершённых
+    // предшественников, уходят в очередь одной пачкой
+    void release_successors(const std::vector<TaskId>& successors) {
+        std::vector<TaskId> ready;
+        for (TaskId id : successors) {
+            TaskWrapperBase* next = table.find(id);
+            if (next && next->release_dependency()) {
+                ready.push_back(id);
+            }
+        }
+        if (!ready.empty()) {
+            enqueue_tasks(ready.data(), ready.size());
+        }
+    }
+
+    // Выполняет задачу, взятую из очереди, и сразу же, на этом же потоке,
+    // цепочку её продолжений
+    void run_task(TaskId task_id) {
+        while (task_id != NO_TASK) {
+            TaskWrapperBase* task = table.find(task_id);
+            if (!task) {
+                break;
+            }
+            bool detached = task->is_detached();
+            if (task->take_admission()) {
+                admission.release();
+            }
+
+            if (!task->is_cancelled()) {
+                bool timed = timing.load(std::memory_order_relaxed);
+                uint64_t start = 0;
+                if (timed) {
+                    start = now_ns();
+                    if (task->enqueue_time() != 0 && current_stats) {
+                        current_stats->queue_wait.record(start - task->enqueue_time());
+                    }
+                }
+
+                // Продолжение отменённой задачи бросает TaskCancelled из take()
+                // и само становится отменённым
+                try {
+                    task->execute();
+                } catch (const TaskCancelled&) {
+                    task->cancel();
+                }
+
+                if (current_stats) {
+                    current_stats->count_task();
+                    if (timed) {
+                        current_stats->run_time.record(now_ns() - start);
+                    }
+                }
+            }
+            if (task->is_cancelled()) {
+                task->on_cancel();
+            }
+            if (auto* succ = task->get_successors()) {
+                // Последователи отменённого узла отменяются: их входы не готовы
+                if (task->is_cancelled()) {
+                    for (TaskId id : *succ) {
+                        if (TaskWrapperBase* next = table.find(id)) {
+                            next->cancel();
+                        }
+                    }
+                }
+                release_successors(*succ);
+            }
+            TaskId next = task->finish();
+            if (detached) {
+                table.release(task_id);
+            }
+            task_id = next;
+        }
+        task_done();
+    }
+};
+
+// Типизированный дескриптор задачи. get() одноразовый: забирает результат
+// перемещением и освобождает слот в таблице задач.
+template<typename R>
+class TaskHandle {
+    ServerCore* core;
+    TaskId task_id;
+
+public:
+    TaskHandle(ServerCore* server, TaskId id) : core(server), task_id(id) {}
+
+    TaskId id() const { return task_id; }
+    ServerCore* server() const { return core; }
+
+    // Продолжение: g получает результат этой задачи и выполняется на
+    // обработчике сразу после неё, минуя клиентский поток и очередь.
+    // Дескриптор при этом расходуется — результат достаётся продолжению.
+    template<typename G>
+    auto then(G&& g) && {
+        using Next = std::conditional_t<std::is_void_v<R>,
+                                        std::invoke_result<std::decay_t<G>&>,
+                                        std::invoke_result<std::decay_t<G>&, R>>;
+        using R2 = typename Next::type;
+
+        // Устаревший дескриптор: бросаем до вставки продолжения. Родитель
+        // отдаётся продолжению только после успешной вставки.
+        TaskTable& table = core->tasks();
+        TaskWrapperBase* task = table.find(task_id);
+        if (!task) {
+            throw std::runtime_error("Task ID not found");
+        }
+        TaskId parent = task_id;
+        auto body = [g = std::forward<G>(g), core = core, parent]() mutable -> R2 {
+            if constexpr (std::is_void_v<R>) {
+                take_result(core, parent);
+                return std::invoke(g);
+            } else {
+                return std::invoke(g, take_result(core, parent));
+            }
+        };
+
+        TaskId next = table.insert(std::make_unique<TaskWrapper<decltype(body)>>(std::move(body)));
+        task_id = NO_TASK;
+        if (!task->attach_continuation(next)) {
+            core->enqueue_task(next);
+        }
+        return TaskHandle<R2>(core, next);
+    }
+
+    // Бросает TaskCancelled, если задачу вытеснили или отменили
+    R get() {
+        if (!core->tasks().find(task_id)) {
+            throw std::runtime_error("Task ID not found");
+        }
+        return take_result(core, task_id);
+    }
+
+private:
+    // Ждёт задачу, забирает результат и освобождает слот в любом исходе
+    static R take_result(ServerCore* core, TaskId id) {
+        TaskTable& table = core->tasks();
+        auto* state = static_cast<TaskState<R>*>(table.find(id));
+        state->wait_ready();
+        if (state->is_cancelled()) {
+            table.release(id);
+            throw TaskCancelled();
+        }
+        if constexpr (std::is_void_v<R>) {
+            state->take();
+            table.release(id);
+        } else {
+            R res = state->take();
+            table.release(id);
+            return res;
+        }
+    }
+};
+
+// Граф задач (DAG). Узлы создаются сразу, но в очередь попадают только когда
+// завершены все их предшественники: счётчики зависимостей уменьшает
+// обработчик, выполнивший предшественника, так что между этапами клиент
+// не ждёт. Рёбра задаются до submit(); цикл в графе не выполнится никогда.
+class TaskGraph {
+    ServerCore& core;
+    std::vector<TaskId> nodes;
+    bool submitted = false;
+
+    template<typename F, typename... Args>
+    std::unique_ptr<TaskWrapper<std::decay_t<F>, std::decay_t<Args>...>>
+    make_node(F&& func, Args&&... args) {
+        if (submitted) {
+            throw std::logic_error("Task graph already submitted");
+        }
+        return std::make_unique<TaskWrapper<std::decay_t<F>, std::decay_t<Args>...>>(
+            std::forward<F>(func), 
+            std::forward<Args>(args)...
+        );
+    }
+
+public:
+    explicit TaskGraph(ServerCore& server) : core(server) {}
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+    ~TaskGraph() {
+        if (!submitted) {
+            submit();
+        }
+    }
+
+    // Узел, результат которого забирают через дескриптор
+    template<typename F, typename... Args>
+    auto add(F&& func, Args&&... args) {
+        using R = std::invoke_result_t<std::decay_t<F>&, std::decay_t<Args>&...>;
+        TaskId id = core.tasks().insert(make_node(std::forward<F>(func), std::forward<Args>(args)...));
+        nodes.push_back(id);
+        return TaskHandle<R>(&core, id);
+    }
+
+    // Узел без результата, нужный только ради порядка выполнения
+    template<typename F, typename... Args>
+    TaskId add_detached(F&& func, Args&&... args) {
+        auto wrapper = make_node(std::forward<F>(func), std::forward<Args>(args)...);
+        wrapper->set_detached();
+        TaskId id = core.tasks().insert(std::move(wrapper));
+        nodes.push_back(id);
+        return id;
+    }
+
+    // before должен завершиться раньше, чем начнётся after
+    void precede(TaskId before, TaskId after) {
+        if (submitted) {
+            throw std::logic_error("Task graph already submitted");
+        }
+        TaskWrapperBase* from = core.tasks().find(before);
+        TaskWrapperBase* to = core.tasks().find(after);
+        if (!from || !to) {
+            throw std::runtime_error("Task ID not found");
+        }
+        from->add_successor(after);
+        to->add_dependency();
+    }
+
+    // Ставит в очередь узлы без предшественников. Список корней собирается
+    // заранее: после первого push счётчики уже меняют обработчики.
+    void submit() {
+        if (submitted) {
+            return;
+        }
+        submitted = true;
+        std::vector<TaskId> roots;
+        for (TaskId id : nodes) {
+            if (!core.tasks().find(id)->has_dependencies()) {
+                roots.push_back(id);
+            }
+        }
+        core.enqueue_tasks(roots.data(), roots.size());
+    }
+};
+
+// Интеграция с корутинами C++20
+
+// Задача, которая возобновляет корутину на обработчике. Отменённая задача
+// тоже возобновляет корутину (сообщив об отмене через cancelled), иначе её
+// ждущие зависнут навсегда.
+struct ResumeCoroutine {
+    std::coroutine_handle<> h;
+    bool* cancelled = nullptr;
+
+    void operator()() const { h.resume(); }
+    void on_cancel() const {
+        if (cancelled) {
+            *cancelled = true;
+        }
+        h.resume();
+    }
+};
+
+// co_await над дескриптором: корутина засыпает без блокировки потока и
+// возобновляется продолжением задачи прямо на обработчике, который её выполнил
+template<typename R>
+class TaskAwaiter {
+    TaskHandle<R> handle;
+
+public:
+    explicit TaskAwaiter(TaskHandle<R> h) : handle(h) {}
+
+    bool await_ready() {
+        TaskWrapperBase* task = handle.server()->tasks().find(handle.id());
+        return !task || task->is_ready();
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        TaskTable& table = handle.server()->tasks();
+        TaskWrapperBase* task = table.find(handle.id());
+        auto resume = std::make_unique<TaskWrapper<ResumeCoroutine>>(ResumeCoroutine{h});
+        resume->set_detached();
+        TaskId resume_id = table.insert(std::move(resume));
+        // После успешной привязки корутину может возобновить другой поток,
+        // поэтому к членам awaiter-а больше не обращаемся
+        if (task->attach_continuation(resume_id)) {
+            return true;
+        }
+        table.release(resume_id);
+        return false;
+    }
+
+    R await_resume() {
+        return handle.get();
+    }
+};
+
+template<typename R>
+TaskAwaiter<R> operator co_await(TaskHandle<R> handle) {
+    return TaskAwaiter<R>(handle);
+}
+
+// co_await schedule(): корутина уходит в очередь и продолжается на
+// обработчике. При отмене очереди (Server::stop) бросает TaskCancelled.
+struct ScheduleAwaiter {
+    ServerCore* core;
+    Priority prio = Priority::Normal;
+    bool cancelled = false;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        auto resume = std::make_unique<TaskWrapper<ResumeCoroutine>>(ResumeCoroutine{h, &cancelled});
+        resume->set_detached();
+        core->enqueue_task(core->tasks().insert(std::move(resume)), prio);
+    }
+    void await_resume() const {
+        if (cancelled) {
+            throw TaskCancelled();
+        }
+    }
+};
+
+
+template<typename T>
+class CoTask;
+
+namespace detail {
+
+// Хранение результата корутины: значение или void
+template<typename T>
+struct CoResult {
+    std::optional<T> value;
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T extract() { return std::move(*value); }
+};
+
+template<>
+struct CoResult<void> {
+    void return_void() {}
+    void extract() {}
+};
+
+} // namespace detail
+
+// Корутина-задача. Запускается сразу (initial_suspend — never), дальше сама
+// решает, где выполняться, через co_await schedule() / co_await дескриптора.
+// Результат забирают co_await-ом из другой корутины или get() из обычного
+// потока. Деструктор дожидается завершения корутины.
+template<typename T>
+class CoTask {
+public:
+    struct promise_type : detail::CoResult<T> {
+        // Адрес ожидающей корутины; DONE — корутина уже завершилась
+        std::atomic<void*> continuation{nullptr};
+        std::atomic<uint32_t> done{0};
+        std::exception_ptr error;
+
+        // Кадры корутин берутся из того же пула, что и обёртки задач:
+        // память пула не возвращается системе, поэтому notify в
+        // FinalAwaiter после возможного удаления кадра безвреден
+        static void* operator new(size_t size) { return WrapperPool::allocate(size); }
+        static void operator delete(void* p, size_t size) { WrapperPool::deallocate(p, size); }
+
+        CoTask get_return_object() {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                promise_type& p = h.promise();
+                void* next = p.continuation.exchange(DONE, std::memory_order_acq_rel);
+                p.done.store(1, std::memory_order_release);
+                p.done.notify_all();
+                if (next) {
+                    return std::coroutine_handle<>::from_address(next);
+                }
+                return std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    CoTask(CoTask&& other) noexcept : coro(std::exchange(other.coro, {})) {}
+    CoTask& operator=(CoTask&&) = delete;
+    ~CoTask() {
+        if (coro) {
+            wait();
+            coro.destroy();
+        }
+    }
+
+    bool is_ready() const {
+        return coro.promise().done.load(std::memory_order_acquire) != 0;
+    }
+
+    // Блокирующее ожидание из обычного потока
+    T get() {
+        wait();
+        return result();
+    }
+
+    bool await_ready() const { return is_ready(); }
+    bool await_suspend(std::coroutine_handle<> h) {
+        void* expected = nullptr;
+        return coro.promise().continuation.compare_exchange_strong(
+            expected, h.address(), std::memory_order_acq_rel);
+    }
+    T await_resume() { return result(); }
+
+private:
+    static inline char done_marker;
+    static inline void* const DONE = &done_marker;
+
+    std::coroutine_handle<promise_type> coro;
+
+    explicit CoTask(std::coroutine_handle<promise_type> h) : coro(h) {}
+
+    void wait() const {
+        auto& done = coro.promise().done;
+        while (done.load(std::memory_order_acquire) == 0) {
+            done.wait(0, std::memory_order_acquire);
+        }
+    }
+
+    T result() {
+        if (coro.promise().error) {
+            std::rethrow_exception(coro.promise().error);
+        }
+        return coro.promise().extract();
+    }
+};
+
+
+// Пул обработчиков: N потоков разбирают очередь своего ServerCore. Серверы
+// независимы: у каждого своя очередь, таблица задач и счётчики.
+class Server : public ServerCore {
+private:
+    std::vector<std::jthread> workers;
+    std::jthread stats_dumper;
+
+public:
+    // affinity задаёт привязку обработчиков; узлы им назначаются по кругу
+    // в любом случае (на них опирается SchedulerMode::Numa)
+    explicit Server(unsigned workers_num = std::thread::hardware_concurrency(),
+                    SchedulerMode sched = SchedulerMode::GlobalQueue,
+                    Affinity pinning = Affinity::None)
+        : ServerCore(workers_num, sched, pinning) {}
+    ~Server() { stop(); }
+
+    unsigned size() const { return worker_count; }
+    SchedulerMode scheduler() const { return mode; }
+    Affinity worker_affinity() const { return affinity; }
+    unsigned worker_node(unsigned worker) const { return placement[worker].node; }
+
+    // Для корутин: co_await server.submit(f, args...)
+    template<typename... A>
+    auto submit(A&&... args) {
+        return add_task(std::forward<A>(args)...);
+    }
+
+    // co_await server.schedule(): перейти на обработчик или уступить его
+    ScheduleAwaiter schedule(Priority prio = Priority::Normal) {
+        return ScheduleAwaiter{this, prio, false};
+    }
+
+    // Ограничение очереди: не больше capacity принятых, но не начатых задач
+    // (0 — без ограничения); задаётся до отправки задач
+    void set_admission(size_t capacity, AdmissionPolicy policy = AdmissionPolicy::Block) {
+        admission.configure(capacity, policy);
+    }
+
+    // Замеры времени ожидания в очереди, выполнения и простоя обработчиков
+    void set_timing(bool enabled) {
+        timing.store(enabled, std::memory_order_relaxed);
+    }
+
+    // Гистограмма ожидания в очереди по классу (ведёт только Priority)
+    LatencySnapshot queue_wait(Priority prio) const {
+        return queue->queue_wait(prio);
+    }
+
+    ServerStats stats() const {
+        ServerStats st;
+        st.workers.resize(worker_count);
+        for (unsigned i = 0; i < worker_count; i++) {
+            WorkerStatsSnapshot& w = st.workers[i];
+            w.tasks = worker_stats[i].tasks.load(std::memory_order_relaxed);
+            w.idle_ns = worker_stats[i].idle_ns.load(std::memory_order_relaxed);
+            w.queue_wait = worker_stats[i].queue_wait.snapshot();
+            w.run_time = worker_stats[i].run_time.snapshot();
+            st.tasks += w.tasks;
+            st.idle_ns += w.idle_ns;
+            st.queue_wait.merge(w.queue_wait);
+            st.run_time.merge(w.run_time);
+        }
+        st.queue_depth = queue->depth();
+        st.lock_contentions = queue->lock_contentions();
+        st.admission = admission.stats();
+        return st;
+    }
+
+    // Периодическая печать снимка счётчиков, пока сервер не остановлен
+    void dump_stats_every(std::chrono::milliseconds period, std::ostream& out = std::cout) {
+        stats_dumper = std::jthread([this, period, &out](std::stop_token stoken) {
+            std::mutex m;
+            std::condition_variable_any cv;
+            std::unique_lock<std::mutex> lock(m);
+            for (;;) {
+                cv.wait_for(lock, stoken, period, [] { return false; });
+                if (stoken.stop_requested()) {
+                    break;
+                }
+                stats().print(out);
+            }
+        });
+    }
+
+    void start() {
+        stopped.store(false);
+        admission.open();
+        workers.reserve(worker_count);
+        for (unsigned i = 0; i < worker_count; i++) {
+            workers.emplace_back([this, i](std::stop_token stoken) { worker_loop(stoken, i); });
+        }
+    }
+    
+    // Плавная остановка: новые задачи не принимаются, обработчики доделывают
+    // всё, что уже в очереди, вместе с порождёнными продолжениями
+    void drain() {
+        if (workers.empty()) {
+            return;
+        }
+        admission.close();
+        drain_waiting.store(true);
+        size_t n;
+        while ((n = in_flight.load()) != 0) {
+            in_flight.wait(n);
+        }
+        drain_waiting.store(false);
+        stop();
+    }
+
+    // Быстрая остановка: обработчики заканчивают текущие задачи, всё, что
+    // осталось в очереди, отменяется — get() таких задач бросит TaskCancelled
+    void stop() {
+        stats_dumper = std::jthread();
+        if (workers.empty()) {
+            return;
+        }
+        admission.close();
+        for (auto& w : workers) {
+            w.request_stop();
+        }
+        queue->wake_all();
+        workers.clear(); // jthread присоединяется в деструкторе
+
+        // Клиент, принятый до close(), ещё может стоять в push: на полном
+        // кольце он ждёт, пока разбор освободит ячейки. Разбираем, пока все
+        // поставленные задачи не завершатся отменой.
+        stopped.store(true);
+        cancel_queued();
+        while (in_flight.load() != 0) {
+            std::this_thread::yield();
+            cancel_queued();
+        }
+        std::cout << "Server stop!\n";
+    }
+};
+
+template<typename T>
+T f_sq(T x) 
+{
+    //std::this_thread::sleep_for(std::chrono::seconds(2));
+    return x * x;
+}
+
+template<typename T>
+T f_sqrt(T x) 
+{
+    //std::this_thread::sleep_for(std::chrono::seconds(1));
+    return std::sqrt(x);
+}
+
+template<typename T>
+T f_sin(T x) 
+{
+    //std::this_thread::sleep_for(std::chrono::seconds(2));
+    return std::sin(x);
+}
+
+template<typename T>
+T f_smthlse(T a, T b, T c) 
+{
+    return a * b + c;
+}
+